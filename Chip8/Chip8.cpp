@@ -2,16 +2,103 @@
 	Chip8/SuperChip8 implementation
 */
 #include "Chip8.hpp"
+#include "Chip8Dispatch.hpp"
+#include "Chip8Jit.hpp"
+#include "Chip8Aot.hpp"
+#include "Chip8Clock.hpp"
+#include "Chip8Hash.hpp"
+#ifdef CHIP8_TRACE
+#include "Chip8Trace.hpp"
+#endif
+#ifdef CHIP8_PROFILE
+#include "Chip8Profile.hpp"
+#endif
 #include <iostream>
 #include <cstdio>
 #include <fstream>
 #include <iomanip>
+#include <cstring>
+#include <chrono>
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
 
-// Function pointers
+// Chip Fontset
+const unsigned char chip8::chip8_fontset[80] = {
+	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+	0x20, 0x60, 0x20, 0x20, 0x70, // 1
+	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+// Superchip Fontset
+const unsigned char chip8::schip8_fontset[160] = {
+	0x00, 0x3C, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x3C, 0x00, //0
+	0x00, 0x08, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x3E, 0x00, //1
+	0x00, 0x38, 0x44, 0x04, 0x08, 0x10, 0x20, 0x44, 0x7C, 0x00, //2
+	0x00, 0x38, 0x44, 0x04, 0x18, 0x04, 0x04, 0x44, 0x38, 0x00, //3
+	0x00, 0x0C, 0x14, 0x24, 0x24, 0x7E, 0x04, 0x04, 0x0E, 0x00, //4
+	0x00, 0x3E, 0x20, 0x20, 0x3C, 0x02, 0x02, 0x42, 0x3C, 0x00, //5
+	0x00, 0x0E, 0x10, 0x20, 0x3C, 0x22, 0x22, 0x22, 0x1C, 0x00, //6
+	0x00, 0x7E, 0x42, 0x02, 0x04, 0x04, 0x08, 0x08, 0x08, 0x00, //7
+	0x00, 0x3C, 0x42, 0x42, 0x3C, 0x42, 0x42, 0x42, 0x3C, 0x00, //8
+	0x00, 0x3C, 0x42, 0x42, 0x42, 0x3E, 0x02, 0x04, 0x78, 0x00, //9
+	0x00, 0x18, 0x08, 0x14, 0x14, 0x14, 0x1C, 0x22, 0x77, 0x00, //A
+	0x00, 0x7C, 0x22, 0x22, 0x3C, 0x22, 0x22, 0x22, 0x7C, 0x00, //B
+	0x00, 0x1E, 0x22, 0x40, 0x40, 0x40, 0x40, 0x22, 0x1C, 0x00, //C
+	0x00, 0x78, 0x24, 0x22, 0x22, 0x22, 0x22, 0x24, 0x78, 0x00, //D
+	0x00, 0x7E, 0x22, 0x28, 0x38, 0x28, 0x20, 0x22, 0x7E, 0x00, //E
+	0x00, 0x7E, 0x22, 0x28, 0x38, 0x28, 0x20, 0x20, 0x70, 0x00  //F
+};
+
+// Opcode to handler id, see Chip8Dispatch.hpp
+static constexpr chip8DispatchTable dispatch;
+
+// Entry points of one quirks instantiation
+struct chip8::engine {
+	void (chip8::*execute)();
+	unsigned int (chip8::*interpret)(unsigned int);
+};
+
+const chip8::engine chip8::engines[] = {
+	{ &chip8::executeAs<chip8QuirksDefault>, &chip8::interpretAs<chip8QuirksDefault> },
+	{ &chip8::executeAs<chip8QuirksChip8>, &chip8::interpretAs<chip8QuirksChip8> },
+	{ &chip8::executeAs<chip8QuirksChip48>, &chip8::interpretAs<chip8QuirksChip48> },
+	{ &chip8::executeAs<chip8QuirksSchip11>, &chip8::interpretAs<chip8QuirksSchip11> },
+	{ &chip8::executeAs<chip8QuirksXoChip>, &chip8::interpretAs<chip8QuirksXoChip> },
+};
 
 chip8::chip8() {
+	clockSpeed = 600;
+	fastForward = 1;
+	platform = platformDefault;
+	quirks = &engines[platformDefault];
+	rngSeed = 0x2545F491;
+	diagnostic = NULL;
+	diagnosticUser = NULL;
+#ifdef CHIP8_TRACE
+	trace = NULL;
+#endif
+#ifdef CHIP8_PROFILE
+	profiler = NULL;
+#endif
 	initialize();
 }
+
+chip8::~chip8() {
+}
 void chip8::initialize() {
 
     pc = 0x200;  // Program counter starts at 0x200
@@ -20,18 +107,23 @@ void chip8::initialize() {
     sp = 0;      // Reset stack pointer
 
     // Clear display
-	memset(gfx, 0x0, 128 * 64);
+	memset(gfx, 0x0, sizeof(gfx));
     // Clear stack
-	memset(stack, 0x0, 16);
+	memset(stack, 0x0, sizeof(stack));
     // Clear registers V0-VF
 	memset(V, 0x0, 16);
     // Clear memory
 	memset(memory, 0x0, 4096);
 	// Clear RPL
 	memset(RPL, 0x0, 8);
-	
-	
-	
+	// Clear keys
+	keys = 0;
+	keysTaken = 0;
+	// Drop decoded instructions
+	invalidate(0x0, 4096);
+	// Nothing presented yet
+	damage.hash = 0;
+	markAllDamage();
 
     // Load fontset
     for (int i = 0; i < 80; ++i)
@@ -40,6 +132,10 @@ void chip8::initialize() {
     // Reset timers
     delay_timer = 0;
     sound_timer = 0;
+	timerClock = 0;
+	restartRun();
+	memset(pattern, 0x0, sizeof(pattern));
+	pitch = 64;
 
 	// Flags
 	drawFlag = false;
@@ -69,9 +165,17 @@ bool chip8::loadGame(const char* game) {
 	// read data:
 	in.seekg(0, in.beg);
 	in.read(buffer, size);
+	invalidate(0x200, (unsigned short)size);
 
-	// save filename of file for resetting
-	resetFilePath = std::string(game);
+	// keep the powered-on machine with this ROM for resetting
+	std::shared_ptr<chip8State> image = std::make_shared<chip8State>();
+	memset(image.get(), 0x0, sizeof(chip8State));
+	memcpy(image->memory, chip8_fontset, sizeof(chip8_fontset));
+	memcpy(&image->memory[0x200], &memory[0x200], size);
+	image->pc = 0x200;
+	image->pitch = 64;
+	image->rng = rngSeed;
+	pristine = image;
 
 	// close file
 	in.close();
@@ -79,51 +183,730 @@ bool chip8::loadGame(const char* game) {
 }
 
 void chip8::emulateCycle() {
+#ifdef CHIP8_TRACE
+	if (debugMode && trace) {
+		chip8TraceRecord r;
+		unsigned char before[16];
+		memcpy(before, V, 16);
+		r.cycle = cycleCount;
+		r.pc = pc;
+		execute();
+		r.opcode = opcode;
+		r.I = I;
+		r.changed = 0;
+		for (int x = 0; x < 16; x++)
+			if (V[x] != before[x])
+				r.changed |= 1 << x;
+		memcpy(r.V, V, 16);
+		trace->push(r);
+	}
+	else
+#endif
     execute();
-	if(debugMode)
-		std::cout << std::hex << opcode << std::endl;
 
     // Update timers
-    if (delay_timer > 0)
-        --delay_timer;
+	advanceClock(1);
+}
+
+unsigned int chip8::emulateCycles(unsigned int cycles) {
+	unsigned int done = 0;
+	while (done < cycles && !exitFlag) {
+		unsigned int slice = applyInput(cycles - done);
+		unsigned int n = runSlice(slice);
+		done += n;
+		// Exit or an FX0A wait
+		if (n < slice)
+			break;
+	}
+	return done;
+}
+
+unsigned int chip8::applyInput(unsigned int cycles) {
+	while (!inputQueue.empty() && inputQueue.front().cycle <= cycleCount) {
+		const chip8InputEvent& e = inputQueue.front();
+		setKey(e.key, e.pressed);
+		inputStats.applied++;
+		if (e.arrived) {
+			if (!inputUnframed || e.arrived < inputArrivedMin)
+				inputArrivedMin = e.arrived;
+			inputUnframed++;
+			inputArrivedSum += e.arrived;
+		}
+		inputQueue.pop_front();
+	}
+	if (!inputQueue.empty() && inputQueue.front().cycle - cycleCount < cycles)
+		cycles = (unsigned int)(inputQueue.front().cycle - cycleCount);
+	return cycles;
+}
+
+unsigned int chip8::runSlice(unsigned int cycles) {
+	unsigned int done = 0;
+	bool useJit = jit && !debugMode;
+	// Translated code shifts VX, as the default profile does
+	bool useAot = aot && !debugMode && aot->ready() && !chip8PlatformQuirks(platform).shiftVY;
+	bool threaded = !debugMode;
+#ifdef CHIP8_PROFILE
+	useJit = useJit && !profiler;
+	useAot = useAot && !profiler;
+	threaded = threaded && !profiler;
+#endif
+	if (threaded && !useJit && !useAot)
+		return interpret(cycles);
+	while (done < cycles && !exitFlag) {
+		if (threaded) {
+			unsigned int skipped = skipIdle(cycles - done);
+			if (skipped > 0) {
+				done += skipped;
+				continue;
+			}
+		}
+		if (useAot) {
+			unsigned int n = aot->run(cycles - done);
+			if (n > 0) {
+				advanceClock(n);
+				done += n;
+				continue;
+			}
+		}
+		if (useJit) {
+			unsigned int n = jit->run(cycles - done);
+			if (n > 0) {
+				advanceClock(n);
+				done += n;
+				continue;
+			}
+		}
+		unsigned short lastPc = pc;
+		emulateCycle();
+		done++;
+		// FX0A without a key leaves pc in place
+		if (!noKeyWait() && pc == lastPc)
+			break;
+	}
+	return done;
+}
 
-    if (sound_timer > 0){
-		if (sound_timer == 1)
+bool chip8::setJitMode(bool enable) {
+	if (!enable) {
+		jit.reset();
+		return true;
+	}
+	if (!jit)
+		jit.reset(new chip8Jit(*this));
+	if (!jit->available()) {
+		jit.reset();
+		return false;
+	}
+	return true;
+}
+
+bool chip8::setAotProgram(const chip8AotProgram* program) {
+	if (!program) {
+		aot.reset();
+		return true;
+	}
+	aot.reset(new chip8Aot(*this, *program));
+	return aot->ready();
+}
+
+void chip8::setPlatform(chip8Platform p) {
+	if (p >= chip8PlatformCount)
+		p = platformDefault;
+	platform = p;
+	quirks = &engines[p];
+	// Blocks compiled for the old profile's shifts
+	if (jit)
+		jit->flush();
+}
+
+chip8Platform chip8::getPlatform() const {
+	return platform;
+}
+
+void chip8::setClockSpeed(unsigned int ips) {
+	// At least one instruction per timer tick
+	clockSpeed = ips < 60 ? 60 : ips;
+	timerClock %= clockSpeed;
+}
+
+unsigned int chip8::getClockSpeed() const {
+	return clockSpeed;
+}
+
+uint64_t chip8::getIdleCycles() const {
+	return idleCycles;
+}
+
+uint64_t chip8::getFusionCount(chip8Fusion f) const {
+	return f < chip8FusionCount ? fusionCount[f] : 0;
+}
+
+void chip8::seed(uint32_t value) {
+	rngSeed = value ? value : 0x2545F491;
+	rng = rngSeed;
+}
+
+uint32_t chip8::getSeed() const {
+	return rngSeed;
+}
+
+void chip8::setDiagnostic(chip8Diagnostic fn, void* user) {
+	diagnostic = fn;
+	diagnosticUser = user;
+}
+
+uint64_t chip8::getTimerTicks() const {
+	return timerTicks;
+}
+
+uint64_t chip8::getSoundTicks() const {
+	return soundTicks;
+}
+
+const unsigned char* chip8::getAudioPattern() const {
+	return pattern;
+}
+
+unsigned char chip8::getPitch() const {
+	return pitch;
+}
+
+uint8_t chip8::random() {
+	uint32_t s = rng;
+	s ^= s << 13;
+	s ^= s >> 17;
+	s ^= s << 5;
+	rng = s;
+	return (uint8_t)(s % 0xFF);
+}
+
+void chip8::setFastForward(unsigned int factor) {
+	fastForward = factor > 0 ? factor : 1;
+}
+
+unsigned int chip8::runFor(unsigned int cycles) {
+	unsigned int done = 0;
+	while (done < cycles && !exitFlag) {
+		done += emulateCycles(cycles - done);
+		// Still on FX0A: re-running it would only move the clock, up to
+		// the next key event
+		if (done < cycles && !exitFlag && !noKeyWait()) {
+			unsigned int wait = applyInput(cycles - done);
+			advanceClock(wait);
+			idleCycles += wait;
+			done += wait;
+		}
+	}
+	return done;
+}
+
+unsigned int chip8::runFrame() {
+	return runFrames(fastForward);
+}
+
+unsigned int chip8::runFrames(unsigned int frames) {
+	unsigned int done = 0;
+	for (unsigned int f = 0; f < frames && !exitFlag; f++) {
+		// Instructions until the accumulator reaches the next tick
+		done += runFor((clockSpeed - timerClock + 59) / 60);
+	}
+	return done;
+}
+
+unsigned int chip8::runUncapped(unsigned int budgetMicros) {
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::microseconds(budgetMicros);
+	unsigned int frames = 0;
+	do {
+		runFrames(1);
+		frames++;
+	} while (!exitFlag && std::chrono::steady_clock::now() < end);
+	return frames;
+}
+
+void chip8::advanceClock(unsigned int cycles) {
+	cycleCount += cycles;
+	uint64_t acc = timerClock + (uint64_t)cycles * 60;
+	updateTimers((unsigned int)(acc / clockSpeed));
+	timerClock = (unsigned int)(acc % clockSpeed);
+}
+
+void chip8::updateTimers(unsigned int ticks) {
+	timerTicks += ticks;
+	soundTicks += sound_timer < ticks ? sound_timer : ticks;
+	if (delay_timer > 0)
+		delay_timer = delay_timer > ticks ? delay_timer - ticks : 0;
+
+	if (sound_timer > 0) {
+		if (sound_timer <= ticks) {
 			beepFlag = true;
-        --sound_timer;
-    }
+			sound_timer = 0;
+		}
+		else
+			sound_timer -= ticks;
+	}
 }
 void chip8::fetch(){
-    opcode = memory[pc] << 8 | memory[pc + 1];
+    opcode = memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF];
 }
 
 void chip8::execute() {
-    fetch();
-	void(chip8::*chip8call)(void);
-	chip8call = Chip8Table[(opcode & 0xF000) >> 12];
-	(this->*chip8call)();
+	(this->*quirks->execute)();
+}
+
+unsigned int chip8::interpret(unsigned int cycles) {
+	return (this->*quirks->interpret)(cycles);
+}
+
+template <class Q>
+void chip8::executeAs() {
+	decodedIns& d = decodeCache[pc & 0xFFF];
+	if (!d.valid) {
+		fetch();
+		d.opcode = opcode;
+		decode(d);
+	}
+	ins = &d;
+	opcode = d.opcode;
+#ifdef CHIP8_PROFILE
+	if (profiler) {
+		unsigned short at = pc;
+		uint64_t start = chip8Profiler::now();
+		dispatchOp<Q>(d.handler);
+		profiler->record(d.handler, at, chip8Profiler::now() - start);
+		if (d.handler == op2NNN)
+			profiler->call(d.nnn);
+		else if (d.handler == op00EE)
+			profiler->ret();
+		return;
+	}
+#endif
+	dispatchOp<Q>(d.handler);
+}
+
+template <class Q>
+inline void chip8::dispatchOp(unsigned char handler) {
+	switch (handler) {
+	case op0NNN: cpu0NNN(); break;
+	case op00CN: cpu00CN(); break;
+	case op00E0: cpu00E0(); break;
+	case op00EE: cpu00EE(); break;
+	case op00FB: cpu00FB(); break;
+	case op00FC: cpu00FC(); break;
+	case op00FD: cpu00FD(); break;
+	case op00FE: cpu00FE(); break;
+	case op00FF: cpu00FF(); break;
+	case op1NNN: cpu1NNN(); break;
+	case op2NNN: cpu2NNN(); break;
+	case op3XNN: cpu3XNN(); break;
+	case op4XNN: cpu4XNN(); break;
+	case op5XY0: cpu5XY0(); break;
+	case op6XNN: cpu6XNN(); break;
+	case op7XNN: cpu7XNN(); break;
+	case op8XY0: cpu8XY0(); break;
+	case op8XY1: cpu8XY1(); break;
+	case op8XY2: cpu8XY2(); break;
+	case op8XY3: cpu8XY3(); break;
+	case op8XY4: cpu8XY4(); break;
+	case op8XY5: cpu8XY5(); break;
+	case op8XY6: cpu8XY6<Q>(); break;
+	case op8XY7: cpu8XY7(); break;
+	case op8XYE: cpu8XYE<Q>(); break;
+	case op9XY0: cpu9XY0(); break;
+	case opANNN: cpuANNN(); break;
+	case opBNNN: cpuBNNN<Q>(); break;
+	case opCXNN: cpuCNNN(); break;
+	case opDXYN: cpuDXYN<Q>(); break;
+	case opEX9E: cpuEX9E(); break;
+	case opEXA1: cpuEXA1(); break;
+	case opF0NN: cpuF0NN<Q>(); break;
+	case opFX07: cpuFX07(); break;
+	case opFX0A: cpuFX0A(); break;
+	case opFX15: cpuFX15(); break;
+	case opFX18: cpuFX18(); break;
+	case opFX1E: cpuFX1E(); break;
+	case opFX29: cpuFX29(); break;
+	case opFX30: cpuFX30(); break;
+	case opFX33: cpuFX33(); break;
+	case opFX3A: cpuFX3A<Q>(); break;
+	case opFX55: cpuFX55<Q>(); break;
+	case opFX65: cpuFX65<Q>(); break;
+	case opFX75: cpuFX75(); break;
+	case opFX85: cpuFX85(); break;
+	default: cpuNULL(); break;
+	}
+}
+
+template <class Q>
+unsigned int chip8::interpretAs(unsigned int cycles) {
+	unsigned int done = 0;
+	// Instructions not yet applied to the timers
+	unsigned int clock = 0;
+	while (done < cycles && !exitFlag) {
+		decodedIns& d = decodeCache[pc & 0xFFF];
+		if (!d.valid) {
+			fetch();
+			d.opcode = opcode;
+			decode(d);
+		}
+		if (d.timed) {
+			advanceClock(clock);
+			clock = 0;
+		}
+		if (d.idle) {
+			unsigned int skipped = skipIdle(cycles - done);
+			if (skipped > 0) {
+				done += skipped;
+				continue;
+			}
+		}
+		if (d.fused != fuseNone) {
+			if (d.fused == fuseUnchecked)
+				fuse(d, pc);
+			// Fused sequences hold no timer or stop opcodes
+			if (d.fused != fuseNone && cycles - done >= chip8FusionLength((chip8Fusion)d.fused)) {
+				unsigned int n = runFused<Q>(d);
+				done += n;
+				clock += n;
+				continue;
+			}
+		}
+		ins = &d;
+		opcode = d.opcode;
+		unsigned short lastPc = pc;
+		// d may be invalidated by the handler (FX33, FX55)
+		bool stop = d.stop;
+		dispatchOp<Q>(d.handler);
+		done++;
+		clock++;
+		// FX0A without a key leaves pc in place
+		if (stop && pc == lastPc)
+			break;
+	}
+	advanceClock(clock);
+	return done;
+}
+
+unsigned int chip8::skipIdle(unsigned int cycles) {
+	unsigned short at = pc & 0xFFF;
+	unsigned short op = memory[at] << 8 | memory[(at + 1) & 0xFFF];
+	// 1NNN to itself: nothing but the timers changes, ever
+	if (op == (0x1000 | at)) {
+		opcode = op;
+		advanceClock(cycles);
+		idleCycles += cycles;
+		return cycles;
+	}
+
+	// FX07, 3X00, 1NNN back to the FX07: polls until the delay timer is 0
+	if ((op & 0xF0FF) != 0xF007 || delay_timer == 0)
+		return 0;
+	uint8_t x = (op & 0x0F00) >> 8;
+	unsigned short skip = memory[(at + 2) & 0xFFF] << 8 | memory[(at + 3) & 0xFFF];
+	unsigned short jump = memory[(at + 4) & 0xFFF] << 8 | memory[(at + 5) & 0xFFF];
+	if (skip != (0x3000 | x << 8) || jump != (0x1000 | at))
+		return 0;
+	// Loop passes that read a non-zero delay: each pass is 3 instructions
+	// (180 timer units), the timer has ticked delay_timer times after
+	// delay_timer * clockSpeed - timerClock units
+	uint64_t units = (uint64_t)delay_timer * clockSpeed - timerClock;
+	uint64_t passes = (units + 179) / 180;
+	if (passes > cycles / 3)
+		passes = cycles / 3;
+	if (passes == 0)
+		return 0;
+	// VX holds what the last skipped FX07 read
+	V[x] = delay_timer - (uint8_t)((timerClock + (passes - 1) * 180) / clockSpeed);
+	opcode = jump;
+	unsigned int skipped = (unsigned int)passes * 3;
+	advanceClock(skipped);
+	idleCycles += skipped;
+	return skipped;
+}
+
+void chip8::fuse(decodedIns& d, unsigned short addr) {
+	const decodedIns& b = decodeAt(addr + 2);
+	const decodedIns& c = decodeAt(addr + 4);
+	d.fused = chip8Fuse((chip8Handler)d.handler, (chip8Handler)b.handler, (chip8Handler)c.handler);
+}
+
+template <class Q>
+unsigned int chip8::runFused(const decodedIns& d) {
+	// Valid as long as d is, see invalidate
+	const decodedIns& b = decodeCache[(pc + 2) & 0xFFF];
+	fusionCount[d.fused]++;
+	ins = &d;
+	opcode = d.opcode;
+	switch (d.fused) {
+	case fuseANNN_DXYN:
+		cpuANNN();
+		ins = &b;
+		opcode = b.opcode;
+		cpuDXYN<Q>();
+		return 2;
+	case fuse6XNN_6XNN:
+		cpu6XNN();
+		ins = &b;
+		opcode = b.opcode;
+		cpu6XNN();
+		return 2;
+	case fuse7XNN_3XNN_1NNN:
+	case fuse7XNN_4XNN_1NNN: {
+		unsigned short jump = pc + 4;
+		cpu7XNN();
+		ins = &b;
+		opcode = b.opcode;
+		if (d.fused == fuse7XNN_3XNN_1NNN)
+			cpu3XNN();
+		else
+			cpu4XNN();
+		// Skipped the jump
+		if (pc != jump)
+			return 2;
+		const decodedIns& c = decodeCache[pc & 0xFFF];
+		ins = &c;
+		opcode = c.opcode;
+		cpu1NNN();
+		return 3;
+	}
+	case fuseFX33_FX65:
+		cpuFX33();
+		// The digits landed on this sequence, FX65 has to be decoded again
+		if (!d.valid)
+			return 1;
+		ins = &b;
+		opcode = b.opcode;
+		cpuFX65<Q>();
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+void chip8::decode(decodedIns& d) {
+	unsigned short op = d.opcode;
+	d.x = (op & 0x0F00) >> 8;
+	d.y = (op & 0x00F0) >> 4;
+	d.n = op & 0x000F;
+	d.nn = op & 0x00FF;
+	d.nnn = op & 0x0FFF;
+	d.handler = dispatch.id[op];
+	d.timed = d.handler == opFX07 || d.handler == opFX0A || d.handler == opFX15 || d.handler == opFX18;
+	d.stop = d.handler == op00FD || d.handler == opFX0A;
+	d.idle = d.handler == opFX07 || d.handler == op1NNN;
+	d.fused = fuseUnchecked;
+	d.valid = true;
+}
+
+chip8::decodedIns& chip8::decodeAt(unsigned short addr) {
+	decodedIns& d = decodeCache[addr & 0xFFF];
+	if (!d.valid) {
+		d.opcode = memory[addr & 0xFFF] << 8 | memory[(addr + 1) & 0xFFF];
+		decode(d);
+	}
+	return d;
+}
+
+void chip8::invalidate(unsigned short addr, unsigned short len) {
+	// Stores past 0xFFF wrap to the start of memory, split them there
+	addr &= 0xFFF;
+	if (addr + len > 4096u) {
+		invalidate(0x0, (unsigned short)(addr + len - 4096));
+		len = (unsigned short)(4096 - addr);
+	}
+	// An instruction starting one byte earlier also covers addr, a fused
+	// sequence (up to three instructions) one starting five bytes earlier
+	for (unsigned int i = 0; i < len + 5u; i++)
+		decodeCache[(addr + 0xFFB + i) & 0xFFF].valid = false;
+	if (jit)
+		jit->invalidate(addr, len);
+	if (aot)
+		aot->invalidate(addr, len);
 }
 
 void chip8::reset() {
-	std::ifstream in(resetFilePath, std::ios::in | std::ios::binary);
-	if (in) {
-		in.close();
-		bool isDebug = debugMode;
-		initialize();
-		loadGame(resetFilePath.c_str());
-		debugMode = isDebug;
+	if (pristine) {
+		loadState(*pristine);
+		restartRun();
 	}
 }
 
-void chip8::setKey(char k) {
-	// Clear keys
-	memset(key, 0x0, 16);
-	if (k >= 0x0 && k <= 0xF)
-		key[k] = 1;
+void chip8::restartRun() {
+	cycleCount = 0;
+	idleCycles = 0;
+	timerTicks = 0;
+	soundTicks = 0;
+	memset(fusionCount, 0x0, sizeof(fusionCount));
+	rng = rngSeed;
+	inputQueue.clear();
+	inputUnframed = 0;
+	inputArrivedSum = 0;
+	inputArrivedMin = 0;
+	memset(&inputStats, 0x0, sizeof(inputStats));
+}
+
+std::unique_ptr<chip8> chip8::fork() const {
+	chip8State s;
+	saveState(s);
+	std::unique_ptr<chip8> c = fork(s);
+	// Same memory, so the decoded instructions carry over
+	memcpy(c->decodeCache, decodeCache, sizeof(decodeCache));
+	c->cycleCount = cycleCount;
+	c->idleCycles = idleCycles;
+	c->timerTicks = timerTicks;
+	c->soundTicks = soundTicks;
+	memcpy(c->fusionCount, fusionCount, sizeof(fusionCount));
+	c->inputQueue = inputQueue;
+	return c;
+}
+
+std::unique_ptr<chip8> chip8::fork(const chip8State& s) const {
+	std::unique_ptr<chip8> c(new chip8());
+	c->clockSpeed = clockSpeed;
+	c->fastForward = fastForward;
+	c->setPlatform(platform);
+	c->debugMode = debugMode;
+	c->rngSeed = rngSeed;
+	c->diagnostic = diagnostic;
+	c->diagnosticUser = diagnosticUser;
+	c->pristine = pristine;
+	c->loadState(s);
+	if (jit)
+		c->setJitMode(true);
+	if (aot)
+		c->setAotProgram(&aot->program());
+	return c;
+}
+
+void chip8::setKey(unsigned char k, bool pressed) {
+	if (k > 0xF)
+		return;
+	if (pressed)
+		keys |= 1 << k;
+	else
+		keys &= ~(1 << k);
+	keysTaken &= keys;
+}
+
+void chip8::setKeys(uint16_t mask) {
+	keys = mask;
+	keysTaken &= keys;
+}
+
+uint16_t chip8::getKeys() const {
+	return keys;
 }
 
 void chip8::clearKey() {
-	memset(key, 0x0, 16);
+	keys = 0;
+	keysTaken = 0;
+}
+
+uint64_t chip8::getCycles() const {
+	return cycleCount;
+}
+
+void chip8::queueInput(const chip8InputEvent& e) {
+	inputQueue.push_back(e);
+	if (inputQueue.size() > 1 && e.cycle < inputQueue[inputQueue.size() - 2].cycle)
+		inputQueue.back().cycle = inputQueue[inputQueue.size() - 2].cycle;
+}
+
+void chip8::queueKey(unsigned char k, bool pressed) {
+	chip8InputEvent e;
+	e.cycle = cycleCount;
+	e.arrived = chip8Now();
+	e.key = k;
+	e.pressed = pressed;
+	queueInput(e);
+}
+
+size_t chip8::pendingInput() const {
+	return inputQueue.size();
+}
+
+void chip8::getInputStats(chip8InputStats& out) const {
+	out = inputStats;
+}
+
+void chip8::unpackGfx(unsigned char* out) const {
+	for (int i = 0; i < 128 * 64; i++)
+		out[i] = (gfx[i >> 6] >> (63 - (i & 63))) & 0x1;
+}
+
+void chip8::takeDamage(chip8Damage& out) {
+	unsigned int words = fullscreen ? 128 : 32;
+	uint64_t hash = chip8Hash64(gfx, words * sizeof(uint64_t), fullscreen);
+	out = damage;
+	out.hash = hash;
+	out.changed = hash != damage.hash;
+	if (!out.changed || out.rows == 0) {
+		out.rows = 0;
+		out.left = out.top = out.right = out.bottom = 0;
+	}
+	damage.rows = 0;
+	damage.left = damage.top = 0xFFFF;
+	damage.right = damage.bottom = 0;
+	damage.hash = hash;
+	drawFlag = false;
+
+	// This frame is the first to show the events applied since the last one
+	if (inputUnframed) {
+		uint64_t now = chip8Now();
+		inputStats.framed += inputUnframed;
+		inputStats.latencySum += inputUnframed * now - inputArrivedSum;
+		if (now - inputArrivedMin > inputStats.latencyMax)
+			inputStats.latencyMax = now - inputArrivedMin;
+		inputUnframed = 0;
+		inputArrivedSum = 0;
+	}
+}
+
+// Columns (0 = most significant bit) of the first and last set bit, m != 0
+static inline void pixelSpan(uint64_t m, unsigned int& first, unsigned int& last) {
+#if defined(__GNUC__)
+	first = __builtin_clzll(m);
+	last = 63 - __builtin_ctzll(m);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	unsigned long i;
+	_BitScanReverse64(&i, m);
+	first = 63 - i;
+	_BitScanForward64(&i, m);
+	last = 63 - i;
+#else
+	first = 0;
+	while (!(m & (0x8000000000000000ull >> first)))
+		first++;
+	last = 63;
+	while (!(m & (1ull << (63 - last))))
+		last--;
+#endif
+}
+
+void chip8::markDamage(unsigned int word, uint64_t mask) {
+	if (!mask)
+		return;
+	unsigned int wpr = 1 + (unsigned int)fullscreen;
+	unsigned short row = (unsigned short)(word / wpr);
+	unsigned int first, last;
+	pixelSpan(mask, first, last);
+	unsigned short col = (unsigned short)((word % wpr) * 64);
+	damage.rows |= 1ull << row;
+	if (col + first < damage.left)
+		damage.left = (unsigned short)(col + first);
+	if (col + last + 1 > damage.right)
+		damage.right = (unsigned short)(col + last + 1);
+	if (row < damage.top)
+		damage.top = row;
+	if (row + 1 > damage.bottom)
+		damage.bottom = row + 1;
+}
+
+void chip8::markAllDamage() {
+	unsigned short h = fullscreen ? 64 : 32;
+	damage.rows = h == 64 ? ~0ull : (1ull << h) - 1;
+	damage.left = damage.top = 0;
+	damage.right = fullscreen ? 128 : 64;
+	damage.bottom = h;
 }
 
 bool chip8::noKeyWait() {
@@ -131,6 +914,89 @@ bool chip8::noKeyWait() {
 	return ((opcode & 0xF00F) != 0xF00A);
 }
 
+#ifdef CHIP8_TRACE
+void chip8::setTrace(chip8TraceRing* ring) {
+	trace = ring;
+}
+#endif
+
+#ifdef CHIP8_PROFILE
+void chip8::setProfiler(chip8Profiler* p) {
+	profiler = p;
+}
+#endif
+
+void chip8::saveState(chip8State& s) const {
+	memcpy(s.memory, memory, 4096);
+	memcpy(s.gfx, gfx, sizeof(gfx));
+	memcpy(s.stack, stack, sizeof(stack));
+	s.opcode = opcode;
+	s.pc = pc;
+	s.I = I;
+	s.sp = sp;
+	s.timerClock = timerClock;
+	s.rng = rng;
+	memcpy(s.V, V, 16);
+	memcpy(s.RPL, RPL, 8);
+	for (int k = 0; k < 16; k++)
+		s.key[k] = (keys >> k & 0x1) + (keysTaken >> k & 0x1);
+	s.delay_timer = delay_timer;
+	s.sound_timer = sound_timer;
+	s.drawFlag = drawFlag;
+	s.beepFlag = beepFlag;
+	s.exitFlag = exitFlag;
+	s.fullscreen = fullscreen;
+	s.awaitKey = awaitKey;
+	s.pitch = pitch;
+	memcpy(s.pattern, pattern, sizeof(pattern));
+}
+
+void chip8::loadState(const chip8State& s) {
+	restoreMemory(s.memory);
+	memcpy(gfx, s.gfx, sizeof(gfx));
+	memcpy(stack, s.stack, sizeof(stack));
+	opcode = s.opcode;
+	pc = s.pc;
+	I = s.I;
+	sp = s.sp;
+	timerClock = s.timerClock % clockSpeed;
+	rng = s.rng ? s.rng : rngSeed;
+	memcpy(V, s.V, 16);
+	memcpy(RPL, s.RPL, 8);
+	keys = keysTaken = 0;
+	for (int k = 0; k < 16; k++) {
+		keys |= (s.key[k] != 0) << k;
+		keysTaken |= (s.key[k] == 2) << k;
+	}
+	delay_timer = s.delay_timer;
+	sound_timer = s.sound_timer;
+	drawFlag = s.drawFlag != 0;
+	beepFlag = s.beepFlag != 0;
+	exitFlag = s.exitFlag != 0;
+	fullscreen = s.fullscreen != 0;
+	awaitKey = s.awaitKey != 0;
+	pitch = s.pitch;
+	memcpy(pattern, s.pattern, sizeof(pattern));
+	markAllDamage();
+}
+
+void chip8::restoreMemory(const unsigned char* image) {
+	// Compared in 64 byte lines; runs of changed lines are copied and
+	// invalidated together so the JIT scans its blocks once per run
+	unsigned int start = 0;
+	bool dirty = false;
+	for (unsigned int a = 0; a <= 4096; a += 64) {
+		bool changed = a < 4096 && memcmp(&memory[a], &image[a], 64) != 0;
+		if (changed && !dirty)
+			start = a;
+		else if (!changed && dirty) {
+			memcpy(&memory[start], &image[start], a - start);
+			invalidate((unsigned short)start, (unsigned short)(a - start));
+		}
+		dirty = changed;
+	}
+}
+
 ////////////// Opcodes ////////////////////////////
 
 // 0NNN: Calls RCA 1802 program at address NNN.
@@ -140,22 +1006,26 @@ void chip8::cpu0NNN(){
 
 // *00CN: Scroll display N lines down
 void chip8::cpu00CN() {
-	uint8_t w = 64 + 64 * (uint8_t)(fullscreen);
+	uint8_t wpr = 1 + (uint8_t)(fullscreen);
 	uint8_t h = 32 + 32 * (uint8_t)(fullscreen);
-	uint8_t n = opcode & 0x000F;
-	uint16_t size = w * h;
-	for (uint16_t i = size - 1; i > w * n - 1; i--)
-		gfx[i] = gfx[i - w * n];
+	uint16_t words = wpr * h;
+	uint16_t shift = wpr * ins->n;
+	// Whole rows move as words
+	memmove(gfx + shift, gfx, (words - shift) * sizeof(uint64_t));
 	// padding
-	for (uint16_t i = 0; i < w * n; i++)
-		gfx[i] = 0;
+	memset(gfx, 0x0, shift * sizeof(uint64_t));
+	markAllDamage();
 	drawFlag = true;
 	pc += 2;
 }
 
 // 00E0: Clears the screen  
 void chip8::cpu00E0(){
-	memset(gfx, 0x0, 128 * 64);
+	// Only lit pixels change
+	unsigned int words = fullscreen ? 128 : 32;
+	for (unsigned int i = 0; i < words; i++)
+		markDamage(i, gfx[i]);
+	memset(gfx, 0x0, sizeof(gfx));
 	drawFlag = true;
 	pc += 2;
 }
@@ -169,35 +1039,31 @@ void chip8::cpu00EE() {
 
 //*00FB:  Scroll display 4 pixels right
 void chip8::cpu00FB() {
-	uint8_t w = 64 + 64 * (uint8_t)(fullscreen);
+	uint8_t wpr = 1 + (uint8_t)(fullscreen);
 	uint8_t h = 32 + 32 * (uint8_t)(fullscreen);
-	uint16_t size = w * h;
 	// Increment by row
-	for (uint16_t i = 0; i < size; i += w) {
-		// Now by columns in row
-		for (uint16_t j = i + w - 1; j > i + 3; j--)
-			gfx[j] = gfx[j - 4];
-		// padding
-		for (uint16_t j = i; j < i + 4; j++)
-			gfx[j] = 0;
+	for (uint16_t i = 0; i < wpr * h; i += wpr) {
+		// Carry the low nibble of each word into the next one
+		for (uint16_t j = i + wpr - 1; j > i; j--)
+			gfx[j] = (gfx[j] >> 4) | (gfx[j - 1] << 60);
+		gfx[i] >>= 4;
 	}
+	markAllDamage();
 	drawFlag = true;
 	pc += 2;
 }
 //*00FC:  Scroll display 4 pixels left
 void chip8::cpu00FC() {
-	uint8_t w = 64 + 64 * (uint8_t)(fullscreen);
+	uint8_t wpr = 1 + (uint8_t)(fullscreen);
 	uint8_t h = 32 + 32 * (uint8_t)(fullscreen);
-	uint16_t size = w * h;
 	// Increment by row
-	for (uint16_t i = 0; i < size; i += w) {
-		// Now by columns in row
-		for (uint16_t j = i; j < i + w - 4; j++)
-			gfx[j] = gfx[j + 4];
-		// padding
-		for (uint16_t j = i + w - 5; j < i + w; j++)
-			gfx[j] = 0;
+	for (uint16_t i = 0; i < wpr * h; i += wpr) {
+		// Carry the high nibble of each word into the previous one
+		for (uint16_t j = i; j < i + wpr - 1; j++)
+			gfx[j] = (gfx[j] << 4) | (gfx[j + 1] >> 60);
+		gfx[i + wpr - 1] <<= 4;
 	}
+	markAllDamage();
 	drawFlag = true;
 	pc += 2;
 }
@@ -209,204 +1075,247 @@ void chip8::cpu00FD() {
 //*00FE:  Disable extended screen mode
 void chip8::cpu00FE() {
 	fullscreen = false;
+	markAllDamage();
 	drawFlag = true;
 	pc += 2;
 }
 //*00FF:  Enable extended screen mode for fullscreen graphics
 void chip8::cpu00FF() {
 	fullscreen = true;
+	markAllDamage();
 	drawFlag = true;
 	pc += 2;
 }
 // 1NNN: Jumps to address NNN.
 void chip8::cpu1NNN() {
-    pc = opcode & 0x0FFF;
+    pc = ins->nnn;
 }
 
 // 2NNN: Calls subroutine at NNN.
 void chip8::cpu2NNN() {
     stack[sp] = pc;
     ++sp;
-    pc = opcode & 0x0FFF;
+    pc = ins->nnn;
 }
 // 3NNN: Skips the next instruction if VX equals NN.
 void chip8::cpu3XNN() {
-	pc += 2 + 2 * (uint8_t)(V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF));
+	pc += 2 + 2 * (uint8_t)(V[ins->x] == ins->nn);
 }
 // 4NNN: Skips the next instruction if VX doesn't equal NN.
 void chip8::cpu4XNN() {
-	pc += 2 + 2 * (uint8_t)(V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF));
+	pc += 2 + 2 * (uint8_t)(V[ins->x] != ins->nn);
 
 }
 // 5NNN:  Skips the next instruction if VX equals VY.
 void chip8::cpu5XY0() {
-	pc += 2 + 2 * (uint8_t)(V[(opcode & 0x0F00) >> 8] == V[(opcode & 0x00F0) >> 4]);
+	pc += 2 + 2 * (uint8_t)(V[ins->x] == V[ins->y]);
 }
 // 6NNN: Sets VX to NN.
 void chip8::cpu6XNN(){
-	V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
+	V[ins->x] = ins->nn;
 	pc += 2;
 
 }
 // 7NNN: Adds NN to VX.
 void chip8::cpu7XNN() {
-	V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
+	V[ins->x] += ins->nn;
 	pc += 2;
 
 }
 // 8XY0: Sets VX to the value of VY.
 void chip8::cpu8XY0() {
-	V[(opcode & 0x0F00) >> 8] = V[(opcode & 0x00F0) >> 4];
+	V[ins->x] = V[ins->y];
 	pc += 2;
 }
 // 8XY1: Sets VX to VX or VY.
 void chip8::cpu8XY1() {
-	V[(opcode & 0x0F00) >> 8] |= V[(opcode & 0x00F0) >> 4];
+	V[ins->x] |= V[ins->y];
 	pc += 2;
 }
 // 8XY2: Sets VX to VX and VY.
 void chip8::cpu8XY2() {
-	V[(opcode & 0x0F00) >> 8] &= V[(opcode & 0x00F0) >> 4];
+	V[ins->x] &= V[ins->y];
 	pc += 2;
 }
 // 8XY3: Sets VX to VX xor VY.
 void chip8::cpu8XY3() {
-	V[(opcode & 0x0F00) >> 8] ^= V[(opcode & 0x00F0) >> 4];
+	V[ins->x] ^= V[ins->y];
 	pc += 2;
 }
 // 8XY4: Adds VY to VX. VF is set to 1 when there's a carry, and to 0 when there isn't.
 void chip8::cpu8XY4() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
-	uint16_t y = (opcode & 0x00F0) >> 4;
+	uint16_t x = ins->x;
+	uint16_t y = ins->y;
 	V[0xF] = 1 * (uint8_t)(V[y] > 0xFF - V[x]);
     V[x] += V[y];
     pc += 2;
 }
 // 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
 void chip8::cpu8XY5() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
-	uint16_t y = (opcode & 0x00F0) >> 4;
+	uint16_t x = ins->x;
+	uint16_t y = ins->y;
 	V[0xF] = 1 * (uint8_t)(V[x] >= V[y]);
 	V[x] -= V[y];
 	pc += 2;
 }
 // 8XY6: Shifts VX right by one. VF is set to the value of the least significant bit of VX before the shift.
+template <class Q>
 void chip8::cpu8XY6() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
-	V[0xF] = (V[x] & 0x1);
-	V[x] >>= 1;
+	uint16_t x = ins->x;
+	if (Q::shiftVY) {
+		// VX = VY >> 1, the flag written last
+		uint8_t v = V[ins->y];
+		V[x] = v >> 1;
+		V[0xF] = v & 0x1;
+	}
+	else {
+		V[0xF] = (V[x] & 0x1);
+		V[x] >>= 1;
+	}
 	pc += 2;
 }
 // 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
 void chip8::cpu8XY7() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
-	uint16_t y = (opcode & 0x00F0) >> 4;
+	uint16_t x = ins->x;
+	uint16_t y = ins->y;
 	V[0xF] = 1 * (uint8_t)(V[y] >= V[x]);
 	V[x] = V[y] - V[x];
 	pc += 2;
 }
 // 8XYE: Shifts VX left by one. VF is set to the value of the most significant bit of VX before the shift.
+template <class Q>
 void chip8::cpu8XYE() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
-	V[0xF] = (V[x] & 0x80) >> 7;
-	V[x] <<= 1;
+	uint16_t x = ins->x;
+	if (Q::shiftVY) {
+		uint8_t v = V[ins->y];
+		V[x] = v << 1;
+		V[0xF] = (v & 0x80) >> 7;
+	}
+	else {
+		V[0xF] = (V[x] & 0x80) >> 7;
+		V[x] <<= 1;
+	}
 	pc += 2;
 
 }
 // 9XY0: Skips the next instruction if VX doesn't equal VY.
 void chip8::cpu9XY0() {
-	pc += 2 + 2 * (uint8_t)(V[(opcode & 0x00F0)] != V[(opcode & 0x0F00)]);
+	pc += 2 + 2 * (uint8_t)(V[ins->x] != V[ins->y]);
 }
 // ANNN: Sets I to the address NNN
 void chip8::cpuANNN() {
-    I = opcode & 0x0FFF;
+    I = ins->nnn;
     pc += 2;
 }
-// BNNN: Jumps to the address NNN plus V0.
+// BNNN: Jumps to the address NNN plus V0 (BXNN: plus VX on CHIP-48 and SCHIP).
+template <class Q>
 void chip8::cpuBNNN() {
-	pc = (opcode & 0x0FFF) + V[0];
+	pc = ins->nnn + V[Q::jumpVX ? ins->x : 0];
 
 }
 // CNNN: Sets VX to a random number, masked by NN.
 void chip8::cpuCNNN() {
-	uint8_t x = (opcode & 0x0F00) >> 8;
-	uint8_t mask = opcode & 0x00FF;
-	V[x] = (rand() % 0xFF) & mask;
+	uint8_t x = ins->x;
+	uint8_t mask = ins->nn;
+	V[x] = random() & mask;
 	pc += 2;
 }
 //DXYN: Sprites stored in memory at location in index register (I), maximum 8bits wide. Wraps around the screen. If when drawn, clears pixel, register VF is set to 1 otherwise it is zero. All drawing is XOR drawing (i.e. it toggles the screen pixels) Show N-byte sprite from M(I) at coords (VX,VY), VF = collision. If N = 0 and extended mode, show 16x16 sprite.
+template <class Q>
 void chip8::cpuDXYN() {
-	uint8_t x = V[(opcode & 0x0F00) >> 8];
-	uint8_t y = V[(opcode & 0x00F0) >> 4];
-	uint8_t n = opcode & 0x000F;
+	uint8_t x = V[ins->x];
+	uint8_t y = V[ins->y];
+	uint8_t n = ins->n;
 	uint16_t w = 64 + 64 * (uint8_t)(fullscreen);
 	uint16_t h = 32 + 32 * (uint8_t)(fullscreen);
 	uint16_t size = w * h;
 	uint8_t bigSprite = (uint8_t)(fullscreen && n == 0x0);
 	uint16_t spr_width = 0x8 + 0x8 * bigSprite;
 	uint16_t spr_height = (n == 0x0) ? 0x10 : n;
-	uint16_t pixel;
-	uint16_t shift = bigSprite ? 0x8000 : 0x80;
+	uint16_t words = size / 64;
+	uint64_t pixel;
+	if (Q::clipSprites) {
+		// Only the origin wraps
+		x %= w;
+		y %= h;
+	}
 
     V[0xF] = 0;
     for (uint16_t yline = 0; yline < spr_height; yline++){
+		if (Q::clipSprites && y + yline >= h)
+			break;
 		if (bigSprite) {
-			pixel = memory[I + yline * 2];
+			pixel = memory[(I + yline * 2) & 0xFFF];
 			pixel <<= 0x8;
-			pixel |= memory[I + (yline * 2) + 1];
+			pixel |= memory[(I + yline * 2 + 1) & 0xFFF];
 		}
 		else
-			pixel = memory[I + yline];
-        for (uint16_t xline = 0; xline < spr_width; xline++){
-			if (exitFlag) {
-				std::cout << "asdf" << std::endl;
-			}
-            if ((pixel & (shift >> xline)) != 0){
-				uint16_t idx = (x + xline + ((y + yline) * w)) % size;
-                if (gfx[idx] == 1)
-                    V[0xF] = 1;
-                gfx[idx] ^= 1;
-            }
-        }
+			pixel = memory[(I + yline) & 0xFFF];
+		// Left align the sprite row, then split it over the two words it touches.
+		// Bits past the end of a row continue on the next one, as before.
+		pixel <<= 64 - spr_width;
+		uint16_t idx = (x + ((y + yline) * w)) % size;
+		uint16_t word = idx >> 6;
+		uint16_t next = (word + 1) % words;
+		uint8_t bit = idx & 63;
+		uint64_t first = pixel >> bit;
+		uint64_t second = bit ? pixel << (64 - bit) : 0;
+		// Clipped at the right edge: nothing spills out of a row's last word
+		if (Q::clipSprites && ((word + 1) * 64) % w == 0)
+			second = 0;
+		if ((gfx[word] & first) | (gfx[next] & second))
+			V[0xF] = 1;
+		gfx[word] ^= first;
+		gfx[next] ^= second;
+		markDamage(word, first);
+		markDamage(next, second);
     }
     drawFlag = true;
     pc += 2;
 }
 // EX9E: Skips the next instruction if the key stored in VX is pressed
 void chip8::cpuEX9E() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
-	pc += 2 + 2 * (uint8_t)(key[V[x]] != 0);
-	key[V[x]] = 0;
+	uint16_t x = ins->x;
+	pc += 2 + 2 * (uint8_t)(V[x] < 16 && (keys >> V[x] & 0x1));
 }
 
 // EXA1: Skips the next instruction if the key stored in VX isn't pressed.
 void chip8::cpuEXA1() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
-	pc += 2 + 2 * (uint8_t)(key[V[x]] == 0);
+	uint16_t x = ins->x;
+	pc += 2 + 2 * (uint8_t)(V[x] >= 16 || (keys >> V[x] & 0x1) == 0);
 }
 // *F0NN: I = 28bit address
+template <class Q>
 void chip8::cpuF0NN() {
-	I = opcode & 0x00FF;
+	if (Q::xoAudio && ins->nn == 0x02) {
+		for (int i = 0; i < 16; i++)
+			pattern[i] = memory[(I + i) & 0xFFF];
+		pc += 2;
+		return;
+	}
+	I = ins->nn;
 	pc += 2;
 }
 // FX07:  Sets VX to the value of the delay timer.
 void chip8::cpuFX07() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
+	uint16_t x = ins->x;
 	V[x] = delay_timer;
 	pc += 2;
 }
 // FX0A: A key press is awaited, and then stored in VX.
 void chip8::cpuFX0A() {
-	uint8_t x = (opcode & 0x0F00) >> 8;
+	uint8_t x = ins->x;
+	// Highest key pressed since the last FX0A returned it
+	uint16_t fresh = keys & ~keysTaken;
 	int8_t c = -1;
 	for (uint8_t i = 0; i < 0x10; i++) {
-		if (key[i] != 0)
+		if ((fresh >> i) & 0x1)
 			c = i;
 	}
 	if (c > -1) {
 		V[x] = c;
 		pc += 2;
-		memset(key, 0x0, 16);
+		keysTaken |= 1 << c;
 	}
 	else {
 		awaitKey = true;
@@ -414,18 +1323,18 @@ void chip8::cpuFX0A() {
 }
 // FX15: Sets the delay timer to VX.
 void chip8::cpuFX15() {
-	delay_timer = V[(opcode & 0x0F00) >> 8];
+	delay_timer = V[ins->x];
 	pc += 2;
 
 }
 // FX18: Sets the sound timer to VX.
 void chip8::cpuFX18() {
-	sound_timer = V[(opcode & 0x0F00) >> 8];
+	sound_timer = V[ins->x];
 	pc += 2;
 }
 // *FX1E: I += VX 
 void chip8::cpuFX1E() {
-	I += V[(opcode & 0x0F00) >> 8];
+	I += V[ins->x];
 	if (I > 0xFFF) {
 		V[0xF] = 1;
 	}
@@ -434,45 +1343,65 @@ void chip8::cpuFX1E() {
 
 // FX29: Sets I to the location of the sprite for the character in VX. Characters 0-F (in hexadecimal) are represented by a 4x5 font.
 void chip8::cpuFX29() {
-	I = V[(opcode & 0x0F00) >> 8] * 0x5;
+	I = V[ins->x] * 0x5;
 	pc += 2;
 }
 
 // *FX30: Point I to 10-byte font sprite for digit VX (0..9)
 void chip8::cpuFX30() {
-	I = V[(opcode & 0x0F00) >> 8] * 0xA;
+	I = V[ins->x] * 0xA;
 	pc += 2;
 }
 // FX33: Stores the Binary-coded decimal representation of VX, with the most significant of three digits at the address in I, the middle digit at I plus 1, and the least significant digit at I plus 2. (See wiki for more info)
 void chip8::cpuFX33() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
-	memory[I] = V[x] / 100;
-	memory[I + 1] = (V[x] / 10) % 10;
-	memory[I + 2] = (V[x] % 100) % 10;
+	uint16_t x = ins->x;
+	memory[I & 0xFFF] = V[x] / 100;
+	memory[(I + 1) & 0xFFF] = (V[x] / 10) % 10;
+	memory[(I + 2) & 0xFFF] = (V[x] % 100) % 10;
+	invalidate(I, 3);
 	pc += 2;
 }
+// XO-CHIP FX3A: Sets the audio pattern pitch to VX
+template <class Q>
+void chip8::cpuFX3A() {
+	if (Q::xoAudio) {
+		pitch = V[ins->x];
+		pc += 2;
+	}
+	else if (ins->x == 0x0)
+		cpuF0NN<Q>();
+	else
+		cpuNULL();
+}
 
 // FX55: Stores V0 to VX in memory starting at address I.
+template <class Q>
 void chip8::cpuFX55() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
+	uint16_t x = ins->x;
 	for (uint8_t i = 0; i <= x; i++) {
-		memory[I + i] = V[i];
+		memory[(I + i) & 0xFFF] = V[i];
 	}
+	invalidate(I, x + 1);
+	if (Q::index != indexKeep)
+		I += x + (Q::index == indexAddX1);
 	pc += 2;
 
 }
 // FX65: Fills V0 to VX with values from memory starting at address I.
+template <class Q>
 void chip8::cpuFX65() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
+	uint16_t x = ins->x;
 	for (uint8_t i = 0; i <= x; i++) {
-		V[i] = memory[I + i];
+		V[i] = memory[(I + i) & 0xFFF];
 	}
+	if (Q::index != indexKeep)
+		I += x + (Q::index == indexAddX1);
 	pc += 2;
 }
 
 // *FX75: Store V0..VX in RPL user flags (X <= 7)
 void chip8::cpuFX75() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
+	uint16_t x = ins->x;
 	x = x <= 7 ? x : 7;
 	for (uint8_t i = 0; i <= x; i++) {
 		RPL[i] = V[i];
@@ -481,7 +1410,7 @@ void chip8::cpuFX75() {
 }
 // *FX85: Read V0..VX from RPL user flags (X <= 7) 
 void chip8::cpuFX85() {
-	uint16_t x = (opcode & 0x0F00) >> 8;
+	uint16_t x = ins->x;
 	x = x <= 7 ? x : 7;
 	for (uint8_t i = 0; i <= x; i++) {
 		V[i] = RPL[i];
@@ -492,60 +1421,7 @@ void chip8::cpuFX85() {
 ////////////// Function pointers ////////////////////////////
 
 void chip8::cpuNULL() {
-    std::cout << "Unknown opcode: " << opcode << std::endl;
+	if (diagnostic)
+		diagnostic(diagnosticUser, pc, opcode, "Unknown opcode");
 	pc += 2;
 }
-
-void chip8::cpuARITHMETIC() {
-	void(chip8::*chip8call)(void);
-	chip8call = Chip8Arithmetic[(opcode & 0x000F)];
-	(this->*chip8call)();
-}
-
-void chip8::cpuKEYS() {
-	void(chip8::*chip8call)(void);
-	chip8call = Chip8Keys[((opcode & 0x00F0) >> 4) - 0x9];
-	(this->*chip8call)();
-}
-
-void chip8::cpuSTART() {
-	if ((opcode & 0x00F0) >> 4 == 0xF) {
-		void(chip8::*chip8call)(void);
-		chip8call = Chip8Screen[(opcode & 0x000F) - 0xB];
-		(this->*chip8call)();
-	}
-	else if ((opcode & 0x00F0) >> 4 == 0xC) {
-		cpu00CN();
-	}
-	else {
-		switch (opcode & 0x000F) {
-		case 0x0000: cpu00E0(); break;
-		case 0x000E: cpu00EE(); break;
-		default: cpuNULL(); break;
-		}
-	}
-}
-
-void chip8::cpuMEMORY() {
-	switch (opcode & 0x00FF) {
-	case 0x07: cpuFX07(); break;
-	case 0x0A: cpuFX0A();break;
-	case 0x15: cpuFX15(); break;
-	case 0x18: cpuFX18(); break;
-	case 0x1E: cpuFX1E(); break;
-	case 0x29: cpuFX29(); break;
-	case 0x30: cpuFX30(); break;
-	case 0x33: cpuFX33(); break;
-	case 0x55: cpuFX55(); break;
-	case 0x65: cpuFX65(); break;
-	case 0x75: cpuFX75(); break;
-	case 0x85: cpuFX85(); break;
-	default: {
-		if ((opcode & 0xFF00) >> 8 == 0x00F0)
-			cpuF0NN();
-		else
-			cpuNULL();
-		break;
-	}
-}
-}
\ No newline at end of file
@@ -3,10 +3,92 @@
 */
 #pragma once
 #include <iostream>
+#include <string>
+#include <memory>
+#include <deque>
+#include <cstdint>
+#include "Chip8Dispatch.hpp"
+#include "Chip8Quirks.hpp"
+
+class chip8Jit;
+class chip8Aot;
+struct chip8AotProgram;
+#ifdef CHIP8_TRACE
+class chip8TraceRing;
+#endif
+#ifdef CHIP8_PROFILE
+class chip8Profiler;
+#endif
+
+// Complete machine state, plain data so it can be copied and diffed bytewise
+struct chip8State {
+	unsigned char memory[4096];
+	uint64_t gfx[128 * 64 / 64];
+	unsigned short stack[16];
+	unsigned short opcode, pc, I, sp;
+	unsigned int timerClock;
+	unsigned int rng;
+	unsigned char V[16];
+	unsigned char RPL[8];
+	// 0 released, 1 pressed, 2 pressed and already returned by FX0A
+	unsigned char key[16];
+	unsigned char delay_timer;
+	unsigned char sound_timer;
+	unsigned char drawFlag;
+	unsigned char beepFlag;
+	unsigned char exitFlag;
+	unsigned char fullscreen;
+	unsigned char awaitKey;
+	// XO-CHIP audio: FX3A pitch and F002 pattern (5232 bytes, no padding)
+	unsigned char pitch;
+	unsigned char pattern[16];
+};
+
+// Screen changes since the last chip8::takeDamage(), in pixels of the
+// current mode (64x32, or 128x64 when fullscreen)
+struct chip8Damage {
+	// Bit r set: row r changed
+	uint64_t rows;
+	// Bounding rectangle of the changes, right and bottom exclusive.
+	// All 0 when nothing changed.
+	unsigned short left, top, right, bottom;
+	// The visible screen differs from the one the previous call saw. False
+	// when drawing put every pixel back (a sprite drawn twice), so the
+	// frame can be skipped.
+	bool changed;
+	// chip8Hash64 of the visible screen, seeded with the mode
+	uint64_t hash;
+};
+
+// Keypad change for the core to apply once it reaches 'cycle' (see
+// chip8::getCycles), between two instructions
+struct chip8InputEvent {
+	uint64_t cycle;
+	// chip8Now() (Chip8Clock.hpp) when the host received it, 0 = not timed
+	uint64_t arrived;
+	unsigned char key;
+	bool pressed;
+};
+
+// Input latency: from chip8InputEvent::arrived to the first takeDamage()
+// after the event was applied, i.e. the first frame that can show it.
+// Nanoseconds.
+struct chip8InputStats {
+	// Events applied, and the timed ones that reached a frame
+	uint64_t applied;
+	uint64_t framed;
+	uint64_t latencySum;
+	uint64_t latencyMax;
+};
+
+// Receives diagnostics such as unknown opcodes, on the emulating thread
+typedef void(*chip8Diagnostic)(void* user, unsigned short pc, unsigned short opcode, const char* message);
 
 class chip8 {
 public:
-	unsigned char gfx[128 * 64];
+	// Packed 1bpp framebuffer, MSB first: pixel i of the current mode's
+	// w*h screen is bit i of the stream (one word per row, two in extended mode)
+	uint64_t gfx[128 * 64 / 64];
 	bool drawFlag;
 	bool beepFlag;
 	bool exitFlag;
@@ -14,91 +96,262 @@ public:
 	bool awaitKey;
 	bool debugMode;
 	chip8();
+	~chip8();
 private:
+	friend class chip8Jit;
+	friend class chip8Aot;
+	friend class chip8Batch;
+
 	unsigned short opcode, pc, I, sp;
 	unsigned short stack[16];
 	unsigned char memory[4096];
 	unsigned char delay_timer;
 	unsigned char sound_timer;
+	// Instructions per emulated second
+	unsigned int clockSpeed;
+	// Fractional timer tick: +60 per instruction, a tick every clockSpeed
+	unsigned int timerClock;
+	// Frames emulated per runFrame() call
+	unsigned int fastForward;
+	// Instructions accounted for without being executed, see skipIdle
+	uint64_t idleCycles;
+	// 60 Hz timer ticks since initialize() or reset(), and those the sound
+	// timer was running for
+	uint64_t timerTicks;
+	uint64_t soundTicks;
+	// XO-CHIP audio pattern (128 1-bit samples, MSB first) and its pitch
+	unsigned char pattern[16];
+	unsigned char pitch;
+	// Times each chip8Fusion ran, see runFused
+	uint64_t fusionCount[chip8FusionCount];
+	// CXNN generator (xorshift32) and the seed initialize() restarts it from
+	uint32_t rng;
+	uint32_t rngSeed;
+	chip8Diagnostic diagnostic;
+	void* diagnosticUser;
 	unsigned char V[16];
 	unsigned char RPL[8];
-	unsigned char key[16];
+	// Keypad, bit k = key k pressed. FX0A waits for a new press: the held
+	// keys it already returned are in keysTaken until released.
+	uint16_t keys;
+	uint16_t keysTaken;
+	// Instruction slots since initialize() or reset(), the clock input
+	// events run on
+	uint64_t cycleCount;
+	// Events not due yet, in cycle order
+	std::deque<chip8InputEvent> inputQueue;
+	// Timed events applied since the last takeDamage(): how many, the sum
+	// and the earliest of their arrival times
+	uint64_t inputUnframed;
+	uint64_t inputArrivedSum;
+	uint64_t inputArrivedMin;
+	chip8InputStats inputStats;
 	std::string debugIns;
-	std::string resetFilePath;
-
-	void(chip8::*Chip8Table[17])(void) = {
-		&chip8::cpuSTART, &chip8::cpu1NNN, &chip8::cpu2NNN, &chip8::cpu3XNN, &chip8::cpu4XNN, &chip8::cpu5XY0,
-		&chip8::cpu6XNN, &chip8::cpu7XNN, &chip8::cpuARITHMETIC, &chip8::cpu9XY0, &chip8::cpuANNN, &chip8::cpuBNNN,
-		&chip8::cpuCNNN, &chip8::cpuDXYN, &chip8::cpuKEYS, &chip8::cpuMEMORY, &chip8::cpuNULL,
-	};
+	// Accumulated since the last takeDamage(); hash is the one it returned
+	chip8Damage damage;
+	// Machine right after the last loadGame(), what reset() restores.
+	// Shared read-only with forks.
+	std::shared_ptr<const chip8State> pristine;
 
-	void(chip8::*Chip8Arithmetic[16])(void) = {
-		&chip8::cpu8XY0, &chip8::cpu8XY1,&chip8::cpu8XY2, &chip8::cpu8XY3, &chip8::cpu8XY4, &chip8::cpu8XY5,
-		&chip8::cpu8XY6, &chip8::cpu8XY7,&chip8::cpuNULL, &chip8::cpuNULL,&chip8::cpuNULL,&chip8::cpuNULL,
-		&chip8::cpuNULL,&chip8::cpuNULL,&chip8::cpu8XYE, &chip8::cpuNULL,
-	};
-
-	void(chip8::*Chip8Keys[3])(void) = {
-		&chip8::cpuEX9E, &chip8::cpuEXA1, &chip8::cpuNULL,
-	};
-
-	void(chip8::*Chip8Screen[6])(void) = {
-		&chip8::cpu00FB,&chip8::cpu00FC,&chip8::cpu00FD,&chip8::cpu00FE,
-		&chip8::cpu00FF,&chip8::cpuNULL
+	// Pre-decoded instruction: handler id plus extracted operands
+	struct decodedIns {
+		unsigned short opcode;
+		unsigned short nnn;
+		unsigned char x, y, n, nn;
+		// chip8Handler id, see Chip8Dispatch.hpp
+		unsigned char handler;
+		// Reads or writes the timers / may end a run (00FD, FX0A) /
+		// may start an idle loop (FX07, 1NNN)
+		bool timed, stop, idle;
+		bool valid;
+		// chip8Fusion id of the sequence starting here
+		unsigned char fused;
 	};
+	// One entry per memory address, filled lazily by execute()
+	decodedIns decodeCache[4096];
+	// Instruction currently being executed
+	const decodedIns* ins;
+	// Quirk profile and the interpreter instantiated for it
+	struct engine;
+	static const engine engines[chip8PlatformCount];
+	chip8Platform platform;
+	const engine* quirks;
+	// Basic block recompiler, null while running interpreted
+	std::unique_ptr<chip8Jit> jit;
+	// Ahead-of-time compiled ROM, null if none
+	std::unique_ptr<chip8Aot> aot;
+#ifdef CHIP8_TRACE
+	// Receives a record per instruction while debugMode is on
+	chip8TraceRing* trace;
+#endif
+#ifdef CHIP8_PROFILE
+	// Fed by execute(), forces interpretation while set
+	chip8Profiler* profiler;
+#endif
 
 	// Chip Fontset
-	unsigned char chip8_fontset[80] ={
-		0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-		0x20, 0x60, 0x20, 0x20, 0x70, // 1
-		0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-		0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-		0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-		0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-		0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-		0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-		0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-		0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-		0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-		0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-		0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-		0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-		0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-		0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-	};
-
+	static const unsigned char chip8_fontset[80];
 	// Superchip Fontset
-	unsigned char schip8_fontset[160] = {
-		0x00, 0x3C, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x3C, 0x00, //0
-		0x00, 0x08, 0x38, 0x08, 0x08, 0x08, 0x08, 0x08, 0x3E, 0x00, //1
-		0x00, 0x38, 0x44, 0x04, 0x08, 0x10, 0x20, 0x44, 0x7C, 0x00, //2
-		0x00, 0x38, 0x44, 0x04, 0x18, 0x04, 0x04, 0x44, 0x38, 0x00, //3
-		0x00, 0x0C, 0x14, 0x24, 0x24, 0x7E, 0x04, 0x04, 0x0E, 0x00, //4
-		0x00, 0x3E, 0x20, 0x20, 0x3C, 0x02, 0x02, 0x42, 0x3C, 0x00, //5
-		0x00, 0x0E, 0x10, 0x20, 0x3C, 0x22, 0x22, 0x22, 0x1C, 0x00, //6
-		0x00, 0x7E, 0x42, 0x02, 0x04, 0x04, 0x08, 0x08, 0x08, 0x00, //7
-		0x00, 0x3C, 0x42, 0x42, 0x3C, 0x42, 0x42, 0x42, 0x3C, 0x00, //8
-		0x00, 0x3C, 0x42, 0x42, 0x42, 0x3E, 0x02, 0x04, 0x78, 0x00, //9
-		0x00, 0x18, 0x08, 0x14, 0x14, 0x14, 0x1C, 0x22, 0x77, 0x00, //A
-		0x00, 0x7C, 0x22, 0x22, 0x3C, 0x22, 0x22, 0x22, 0x7C, 0x00, //B
-		0x00, 0x1E, 0x22, 0x40, 0x40, 0x40, 0x40, 0x22, 0x1C, 0x00, //C
-		0x00, 0x78, 0x24, 0x22, 0x22, 0x22, 0x22, 0x24, 0x78, 0x00, //D
-		0x00, 0x7E, 0x22, 0x28, 0x38, 0x28, 0x20, 0x22, 0x7E, 0x00, //E
-		0x00, 0x7E, 0x22, 0x28, 0x38, 0x28, 0x20, 0x20, 0x70, 0x00  //F
-	};
+	static const unsigned char schip8_fontset[160];
 
 public:
 	void initialize();
 	bool loadGame(const char* game);
 	void emulateCycle();
-	void setKey(char k);
+	// Runs up to 'cycles' instructions, stopping early on exit or FX0A key wait.
+	// Returns the number of instructions executed.
+	unsigned int emulateCycles(unsigned int cycles);
+	// Switches to the recompiler; returns false if the host cannot run it
+	bool setJitMode(bool enable);
+	// Runs the loaded ROM from code generated by Chip8Aot, null to stop.
+	// Takes precedence over the JIT. Returns false while memory does not
+	// hold the ROM the program was translated from.
+	bool setAotProgram(const chip8AotProgram* program);
+	// Quirk profile the opcodes follow, platformDefault until set. Kept
+	// across initialize() and reset(). Drops recompiled code; AOT programs
+	// are skipped on profiles where 8XY6/8XYE shift VY.
+	void setPlatform(chip8Platform p);
+	chip8Platform getPlatform() const;
+
+	// Scheduler: timers tick at 60 Hz of emulated time, clockSpeed
+	// instructions make one emulated second.
+	void setClockSpeed(unsigned int ips);
+	unsigned int getClockSpeed() const;
+	// Instructions skipped by idle detection (FX07 delay spins, jumps to
+	// self, FX0A waits) since initialize() or reset(). They are included in the
+	// counts returned by the run functions, and timers advance for them.
+	uint64_t getIdleCycles() const;
+	// Times a fused opcode sequence ran as one dispatch since initialize()
+	// or reset(). Only the threaded interpreter fuses.
+	uint64_t getFusionCount(chip8Fusion f) const;
+	// CXNN generator seed, applied now and on every reset (0 is replaced)
+	void seed(uint32_t value);
+	uint32_t getSeed() const;
+	// Diagnostics callback, null (the default) discards them
+	void setDiagnostic(chip8Diagnostic fn, void* user);
+	// Sound: timer ticks since initialize() or reset() and how many of them
+	// had the sound timer running. The tone is on for a contiguous stretch
+	// at the start of each frame, so two readings give a frame's tone
+	// length.
+	uint64_t getTimerTicks() const;
+	uint64_t getSoundTicks() const;
+	// XO-CHIP audio pattern (all zero until F002) and FX3A pitch (64 = 4000
+	// samples/s)
+	const unsigned char* getAudioPattern() const;
+	unsigned char getPitch() const;
+	// Runs 'cycles' instruction slots; an FX0A wait spends the slots it
+	// blocks, timers included. Stops early only on exit.
+	unsigned int runFor(unsigned int cycles);
+	// Runs up to and including the next 60 Hz timer tick, fastForward times
+	unsigned int runFrame();
+	unsigned int runFrames(unsigned int frames);
+	// Frames per runFrame() call, 1 = real time
+	void setFastForward(unsigned int factor);
+	// Runs whole frames back to back until budgetMicros of host time have
+	// passed. Returns the number of frames emulated.
+	unsigned int runUncapped(unsigned int budgetMicros);
+	// Presses or releases key k, leaving the others as they are
+	void setKey(unsigned char k, bool pressed);
+	// Bit k set = key k pressed, replacing the previous state
+	void setKeys(uint16_t mask);
+	uint16_t getKeys() const;
 	void clearKey();
+	// Instruction slots run since initialize() or reset(), idle ones
+	// included
+	uint64_t getCycles() const;
+	// Queues a key change for cycle e.cycle. The run functions stop on
+	// that boundary to apply it, so where it lands does not depend on how
+	// the host slices its run calls. Events stay in order: one timed before
+	// the event queued last, or before now, applies as early as it can.
+	void queueInput(const chip8InputEvent& e);
+	// Key change at the next instruction boundary, timed from now
+	void queueKey(unsigned char k, bool pressed);
+	size_t pendingInput() const;
+	void getInputStats(chip8InputStats& out) const;
+	// Expands gfx to one byte (0/1) per pixel, 128 * 64 bytes
+	void unpackGfx(unsigned char* out) const;
+	// Hands over the screen changes since the last call and clears them
+	// along with drawFlag. Meant to be called once per presented frame.
+	void takeDamage(chip8Damage& out);
+	// Back to the state right after loadGame(), without touching the disk:
+	// the machine, the run counters above and the CXNN generator restart,
+	// and queued input and its latency statistics are dropped
 	void reset();
+	// New instance with this one's state, or with 's', and its settings
+	// (clock speed, fast forward, platform, JIT, AOT, debugMode, seed,
+	// diagnostics) and
+	// reset image. Tracing and profiling are not inherited.
+	// fork() continues the run: the run counters (cycles, idle, ticks,
+	// fusions) carry over, as do queued input events, so events stamped
+	// from getCycles() land on the same instruction in both. Input latency
+	// statistics start over. fork(s) starts a run, all counters at 0.
+	std::unique_ptr<chip8> fork() const;
+	std::unique_ptr<chip8> fork(const chip8State& s) const;
 	bool noKeyWait();
+#ifdef CHIP8_TRACE
+	// Ring filled while debugMode is on, null to stop tracing
+	void setTrace(chip8TraceRing* ring);
+#endif
+#ifdef CHIP8_PROFILE
+	// Profiler fed per instruction, null to stop profiling
+	void setProfiler(chip8Profiler* p);
+#endif
+	// Save states; loading drops decoded and recompiled code for the
+	// memory it changes
+	void saveState(chip8State& s) const;
+	void loadState(const chip8State& s);
 
 private:
 	void fetch();
+	// Zeroes what a run accumulates outside chip8State (cycle, tick, idle
+	// and fusion counters, queued input and its statistics) and restarts
+	// the CXNN generator; for initialize() and reset()
+	void restartRun();
+	// Applies the queued events due by cycleCount and returns 'cycles', or
+	// fewer to stop at the next event
+	unsigned int applyInput(unsigned int cycles);
+	// emulateCycles without the input events
+	unsigned int runSlice(unsigned int cycles);
+	// Run the current profile's instantiation of executeAs / interpretAs
 	void execute();
+	unsigned int interpret(unsigned int cycles);
+	// Executes the instruction at pc, Q being one of the policies in
+	// Chip8Quirks.hpp
+	template <class Q> void executeAs();
+	// Calls the handler of a chip8Handler id; a switch, so handlers inline
+	// into the loops instead of going through member function pointers
+	template <class Q> void dispatchOp(unsigned char handler);
+	// Runs up to 'cycles' instructions from the decode cache with the
+	// clock caught up only around timer opcodes. Same stop rules as
+	// emulateCycles.
+	template <class Q> unsigned int interpretAs(unsigned int cycles);
+	// Fast-forwards an idle loop starting at pc by up to 'cycles'
+	// instructions with the same end state as running it: a jump to self,
+	// or FX07/3X00/1NNN waiting for the delay timer. Returns the
+	// instructions skipped, 0 if pc is not at such a loop.
+	unsigned int skipIdle(unsigned int cycles);
+	// Sets d.fused for the instruction at addr, decoding the ones after it
+	void fuse(decodedIns& d, unsigned short addr);
+	// Runs the fused sequence d starting at pc. Returns the instructions
+	// executed, fewer than the sequence when a skip or a write to the
+	// code leaves it early.
+	template <class Q> unsigned int runFused(const decodedIns& d);
+	// Next CXNN random byte
+	uint8_t random();
+	void updateTimers(unsigned int ticks);
+	// Moves emulated time forward by 'cycles' instructions
+	void advanceClock(unsigned int cycles);
+	void decode(decodedIns& d);
+	// Cache entry for addr, decoded if needed
+	decodedIns& decodeAt(unsigned short addr);
+	// Drops cached decodes overlapping memory[addr..addr+len-1]
+	void invalidate(unsigned short addr, unsigned short len);
+	// Copies a 4 KB image over memory, invalidating only what differs
+	void restoreMemory(const unsigned char* image);
+	// Records that the set bits of 'mask' flipped in gfx[word]
+	void markDamage(unsigned int word, uint64_t mask);
+	// Records a change of the whole screen (scrolls, mode switches, loads)
+	void markAllDamage();
 
 	//////[Opcodes]////////////////////
 
@@ -147,27 +400,27 @@ private:
 	// 8XY5: VY is subtracted from VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
 	void cpu8XY5();
 	// 8XY6: Shifts VX right by one. VF is set to the value of the least significant bit of VX before the shift.
-	void cpu8XY6();
+	template <class Q> void cpu8XY6();
 	// 8XY7: Sets VX to VY minus VX. VF is set to 0 when there's a borrow, and 1 when there isn't.
 	void cpu8XY7();
 	// 8XYE: Shifts VX left by one. VF is set to the value of the most significant bit of VX before the shift.
-	void cpu8XYE();
+	template <class Q> void cpu8XYE();
 	// 9XY0: Skips the next instruction if VX doesn't equal VY.
 	void cpu9XY0();
 	// ANNN: Sets I to the address NNN
 	void cpuANNN();
 	// BNNN: Jumps to the address NNN plus V0.
-	void cpuBNNN();
+	template <class Q> void cpuBNNN();
 	// CNNN: Sets VX to a random number, masked by NN.
 	void cpuCNNN();
 	// DXYN: Sprites stored in memory at location in index register (I), maximum 8bits wide. Wraps around the screen. If when drawn, clears pixel, register VF is set to 1 otherwise it is zero. All drawing is XOR drawing (i.e. it toggles the screen pixels) 
-	void cpuDXYN();
+	template <class Q> void cpuDXYN();
 	// EX9E: Skips the next instruction if the key stored in VX is pressed
 	void cpuEX9E();
 	// EXA1: Skips the next instruction if the key stored in VX isn't pressed.
 	void cpuEXA1();
-	// *F0NN: I = 28bit address
-	void cpuF0NN();
+	// *F0NN: I = 28bit address. XO-CHIP F002: load the audio pattern from I
+	template <class Q> void cpuF0NN();
 	// FX07:  Sets VX to the value of the delay timer.
 	void cpuFX07();
 	// FX0A: A key press is awaited, and then stored in VX.
@@ -184,10 +437,12 @@ private:
 	void cpuFX30();
 	// FX33: Stores the Binary-coded decimal representation of VX, with the most significant of three digits at the address in I, the middle digit at I plus 1, and the least significant digit at I plus 2. (See wiki for more info)
 	void cpuFX33();
+	// XO-CHIP FX3A: audio pattern pitch = VX, F0NN / unknown elsewhere
+	template <class Q> void cpuFX3A();
 	// FX55: Stores V0 to VX in memory starting at address I.
-	void cpuFX55();
+	template <class Q> void cpuFX55();
 	// FX65: Fills V0 to VX with values from memory starting at address I.
-	void cpuFX65();
+	template <class Q> void cpuFX65();
 	// *FX75: Store V0..VX in RPL user flags (X <= 7)
 	void cpuFX75();
 	// *FX85: Read V0..VX from RPL user flags (X <= 7) 
@@ -196,13 +451,5 @@ private:
 
 	// Null opcode
 	void cpuNULL();
-	// Opcode category
-	void cpuARITHMETIC();
-	// Beginning opcodes
-	void cpuSTART();
-	// Memory stuff
-	void cpuMEMORY();
-	// Keys
-	void cpuKEYS();
 };
 	
@@ -0,0 +1,50 @@
+/*
+	Chip8 ahead-of-time compiled ROMs
+*/
+#include "Chip8Aot.hpp"
+#include "Chip8.hpp"
+
+chip8Aot::chip8Aot(chip8& owner, const chip8AotProgram& program) : c(owner), prog(program) {
+	ctx.V = c.V;
+	ctx.I = &c.I;
+	ctx.pc = &c.pc;
+	ctx.sp = &c.sp;
+	ctx.stack = c.stack;
+	ctx.opcode = &c.opcode;
+	ctx.modified = &modified;
+	ctx.runtime = this;
+	memset(changed, 0x0, sizeof(changed));
+	modified = 0;
+	invalidate(0x0, 4096);
+}
+
+unsigned int chip8Aot::run(unsigned int cycles) {
+	if (modified)
+		return 0;
+	return prog.run(ctx, cycles);
+}
+
+void chip8Aot::invalidate(unsigned short addr, unsigned short len) {
+	for (unsigned int i = 0; i < len; i++) {
+		unsigned int a = (addr + i) & 0xFFF;
+		if (!((prog.code[a >> 3] >> (a & 7)) & 1))
+			continue;
+		// The translator only covers bytes inside the image
+		bool now = a < 0x200 || a >= 0x200u + prog.size || c.memory[a] != prog.image[a - 0x200];
+		if (now != changed[a]) {
+			changed[a] = now;
+			if (now)
+				modified++;
+			else
+				modified--;
+		}
+	}
+}
+
+void chip8Aot::exec() {
+	c.execute();
+}
+
+void chip8AotExec(chip8AotContext& x) {
+	x.runtime->exec();
+}
@@ -0,0 +1,85 @@
+/*
+	Chip8 ahead-of-time compiled ROMs
+
+	Chip8Aot (the translator) turns a ROM into a C++ file that defines one
+	chip8AotProgram. Link that file into the program and pass the program
+	to chip8::setAotProgram() to run the ROM as native code:
+
+		extern const chip8AotProgram chip8Aot_pong;
+		c.loadGame("pong.ch8");
+		c.setAotProgram(&chip8Aot_pong);
+
+	Compiled code runs until the cycle budget is spent or it reaches an
+	instruction it leaves to the interpreter (timers, FX0A, 00FD, BNNN,
+	jumps outside the translated code). Once any translated instruction is
+	overwritten, the program is not entered again until memory matches the
+	ROM image again (e.g. after reset()).
+*/
+#pragma once
+#include <cstring>
+
+class chip8;
+class chip8Aot;
+
+// State the generated code works on, pointing into the owning chip8
+struct chip8AotContext {
+	unsigned char* V;
+	unsigned short* I;
+	unsigned short* pc;
+	unsigned short* sp;
+	unsigned short* stack;
+	unsigned short* opcode;
+	// Translated instruction bytes that no longer match the ROM image
+	const unsigned int* modified;
+	chip8Aot* runtime;
+
+	// Generated code keeps V, I and sp in locals, these sync them
+	void spill(const unsigned char* v, unsigned short i, unsigned short s) {
+		memcpy(V, v, 16);
+		*I = i;
+		*sp = s;
+	}
+	void fill(unsigned char* v, unsigned short& i, unsigned short& s) const {
+		memcpy(v, V, 16);
+		i = *I;
+		s = *sp;
+	}
+};
+
+struct chip8AotProgram {
+	const char* name;
+	// ROM image the code was translated from, loaded at 0x200
+	const unsigned char* image;
+	unsigned short size;
+	// One bit per memory byte (LSB first) covered by a translated instruction
+	const unsigned char* code;
+	// Runs up to 'cycles' instructions from *x.pc. Returns the number run;
+	// 0 means the interpreter has to execute the instruction at pc.
+	unsigned int (*run)(chip8AotContext& x, unsigned int cycles);
+};
+
+// Executes the instruction at *x.pc with the interpreter
+void chip8AotExec(chip8AotContext& x);
+
+class chip8Aot {
+public:
+	chip8Aot(chip8& owner, const chip8AotProgram& program);
+	// Same contract as chip8AotProgram::run
+	unsigned int run(unsigned int cycles);
+	// True while every translated instruction matches memory
+	bool ready() const { return modified == 0; }
+	// Rechecks translated bytes in memory[addr..addr+len-1]
+	void invalidate(unsigned short addr, unsigned short len);
+	const chip8AotProgram& program() const { return prog; }
+
+private:
+	friend void chip8AotExec(chip8AotContext& x);
+	void exec();
+
+	chip8& c;
+	const chip8AotProgram& prog;
+	chip8AotContext ctx;
+	unsigned int modified;
+	// Per translated byte: differs from the image
+	bool changed[4096];
+};
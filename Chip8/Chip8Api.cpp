@@ -0,0 +1,85 @@
+/*
+	Chip8 C interface
+*/
+#include "Chip8Api.hpp"
+#include "Chip8.hpp"
+#include <cstring>
+#include <new>
+
+struct chip8Instance {
+	chip8 core;
+	chip8View view;
+};
+
+// Publishes the results of a run call in c->view
+static uint32_t finish(chip8Instance* c, unsigned int cycles) {
+	chip8Damage d;
+	c->core.takeDamage(d);
+	chip8View& v = c->view;
+	v.rows = d.rows;
+	v.cycles = cycles;
+	v.left = d.left;
+	v.top = d.top;
+	v.right = d.right;
+	v.bottom = d.bottom;
+	v.dirty = d.changed;
+	v.fullscreen = c->core.fullscreen;
+	// beepFlag latches, the view reports it once
+	v.beep = c->core.beepFlag;
+	c->core.beepFlag = false;
+	v.exited = c->core.exitFlag;
+	return cycles;
+}
+
+chip8Instance* chip8Create(void) {
+	chip8Instance* c = new (std::nothrow) chip8Instance;
+	if (!c)
+		return nullptr;
+	c->core.initialize();
+	memset(&c->view, 0x0, sizeof(c->view));
+	c->view.gfx = c->core.gfx;
+	return c;
+}
+
+void chip8Destroy(chip8Instance* c) {
+	delete c;
+}
+
+int chip8Load(chip8Instance* c, const char* path) {
+	c->core.initialize();
+	return c->core.loadGame(path) ? 1 : 0;
+}
+
+void chip8Reset(chip8Instance* c) {
+	c->core.reset();
+}
+
+void chip8SetClockSpeed(chip8Instance* c, uint32_t ips) {
+	c->core.setClockSpeed(ips);
+}
+
+void chip8SetFastForward(chip8Instance* c, uint32_t factor) {
+	c->core.setFastForward(factor);
+}
+
+int chip8SetPlatform(chip8Instance* c, const char* name) {
+	chip8Platform p;
+	if (!name || !chip8PlatformFromName(name, p))
+		return 0;
+	c->core.setPlatform(p);
+	return 1;
+}
+
+const chip8View* chip8GetView(chip8Instance* c) {
+	return &c->view;
+}
+
+uint32_t chip8RunCycles(chip8Instance* c, uint16_t keys, uint32_t cycles) {
+	c->core.setKeys(keys);
+	return finish(c, c->core.runFor(cycles));
+}
+
+uint32_t chip8RunFrame(chip8Instance* c, uint16_t keys) {
+	c->core.setKeys(keys);
+	return finish(c, c->core.runFrame());
+}
@@ -0,0 +1,74 @@
+/*
+	Chip8 C interface
+
+	Flat C ABI over chip8 for front ends that cannot use the C++ class,
+	the .NET GUI in particular (see Chip8Desktop/Chip8Native.cs). Every
+	run call takes the whole keypad as a bitmask and runs a batch of
+	instructions, so a front end crosses the boundary once per frame. The
+	results land in a chip8View owned by the instance: its address and the
+	framebuffer it points to stay fixed until chip8Destroy, so managed
+	code reads them in place without marshalling.
+
+	All functions must be called from one thread per instance.
+*/
+#pragma once
+#include <stdint.h>
+
+#if defined(_WIN32) && !defined(CHIP8_STATIC)
+#ifdef CHIP8_EXPORTS
+#define CHIP8_API __declspec(dllexport)
+#else
+#define CHIP8_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define CHIP8_API __attribute__((visibility("default")))
+#else
+#define CHIP8_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chip8Instance chip8Instance;
+
+// Filled by every run call. Layout is part of the ABI.
+typedef struct chip8View {
+	// chip8::gfx: 128 words, one row per word (two when fullscreen),
+	// MSB first
+	const uint64_t* gfx;
+	// Damage since the previous run call, as chip8Damage
+	uint64_t rows;
+	// Instructions the last call ran
+	uint32_t cycles;
+	uint16_t left, top, right, bottom;
+	// The screen differs from the one the previous call left
+	uint8_t dirty;
+	uint8_t fullscreen;
+	// The sound timer ran out during the call
+	uint8_t beep;
+	uint8_t exited;
+} chip8View;
+
+// Null if out of memory
+CHIP8_API chip8Instance* chip8Create(void);
+CHIP8_API void chip8Destroy(chip8Instance* c);
+// Powers on and loads a ROM; 0 on failure
+CHIP8_API int chip8Load(chip8Instance* c, const char* path);
+// Back to the state right after chip8Load
+CHIP8_API void chip8Reset(chip8Instance* c);
+CHIP8_API void chip8SetClockSpeed(chip8Instance* c, uint32_t ips);
+CHIP8_API void chip8SetFastForward(chip8Instance* c, uint32_t factor);
+// Platform by name, see chip8PlatformFromName; 0 if unknown or null
+CHIP8_API int chip8SetPlatform(chip8Instance* c, const char* name);
+// Valid until chip8Destroy
+CHIP8_API const chip8View* chip8GetView(chip8Instance* c);
+
+// Sets the keypad (bit k = key k) and runs 'cycles' instruction slots /
+// one frame (see chip8::runFrame). Return the instructions run.
+CHIP8_API uint32_t chip8RunCycles(chip8Instance* c, uint16_t keys, uint32_t cycles);
+CHIP8_API uint32_t chip8RunFrame(chip8Instance* c, uint16_t keys);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,154 @@
+/*
+	Chip8 audio
+*/
+#include "Chip8Audio.hpp"
+#include "Chip8.hpp"
+#include <cmath>
+#include <cstring>
+
+// Timer ticks per second
+static const uint32_t TICK_RATE = 60;
+// XO-CHIP pattern playback rate at pitch 64, in bits per second
+static const double PATTERN_RATE = 4000.0;
+
+chip8Audio::chip8Audio(unsigned int sampleRate, unsigned int latencyMillis) {
+	rate = sampleRate ? sampleRate : 48000;
+	limit = (uint32_t)((uint64_t)rate * latencyMillis / 1000);
+	// At least one frame fits, or every block would be cut short
+	if (limit < rate / TICK_RATE + 1)
+		limit = rate / TICK_RATE + 1;
+	uint32_t size = 1;
+	while (size < limit)
+		size <<= 1;
+	ring.assign(size, 0);
+	mask = size - 1;
+	toneHz = 440;
+	amplitude = 8192;
+	clear();
+}
+
+void chip8Audio::setTone(unsigned int hz) {
+	toneHz = hz < rate / 2 ? hz : rate / 2;
+}
+
+void chip8Audio::setVolume(unsigned int value) {
+	amplitude = (int16_t)(value < 32767 ? value : 32767);
+}
+
+void chip8Audio::clear() {
+	primed = false;
+	lastTicks = 0;
+	lastSound = 0;
+	tickRemainder = 0;
+	phase = 0;
+	head.store(0, std::memory_order_relaxed);
+	produced.store(0, std::memory_order_relaxed);
+	dropped.store(0, std::memory_order_relaxed);
+	tail.store(0, std::memory_order_relaxed);
+	consumed.store(0, std::memory_order_relaxed);
+	underruns.store(0, std::memory_order_relaxed);
+	silence.store(0, std::memory_order_relaxed);
+	queuedSum.store(0, std::memory_order_relaxed);
+	queuedCount.store(0, std::memory_order_relaxed);
+}
+
+uint32_t chip8Audio::samplesFor(uint64_t ticks) {
+	uint64_t total = ticks * rate + tickRemainder;
+	tickRemainder = (uint32_t)(total % TICK_RATE);
+	return (uint32_t)(total / TICK_RATE);
+}
+
+unsigned int chip8Audio::produce(const chip8& c) {
+	uint64_t ticks = c.getTimerTicks(), sound = c.getSoundTicks();
+	// Start over when c was initialized in between
+	if (!primed || ticks < lastTicks || sound < lastSound) {
+		primed = true;
+		lastTicks = ticks;
+		lastSound = sound;
+		return 0;
+	}
+	uint64_t elapsed = ticks - lastTicks, on = sound - lastSound;
+	lastTicks = ticks;
+	lastSound = sound;
+	if (elapsed == 0)
+		return 0;
+
+	uint32_t n = samplesFor(elapsed);
+	// The sound timer runs from the start of the block
+	uint32_t tone = (uint32_t)(n * on / elapsed);
+
+	// XO-CHIP plays its pattern once loaded, a square tone otherwise
+	const unsigned char* pattern = nullptr;
+	uint32_t step;
+	if (chip8PlatformQuirks(c.getPlatform()).xoAudio) {
+		const unsigned char* p = c.getAudioPattern();
+		for (int i = 0; i < 16; i++)
+			if (p[i]) {
+				pattern = p;
+				break;
+			}
+	}
+	if (pattern) {
+		double bits = PATTERN_RATE * std::pow(2.0, (c.getPitch() - 64) / 48.0);
+		step = (uint32_t)(bits / 128 * 4294967296.0 / rate);
+	}
+	else
+		step = (uint32_t)((uint64_t)toneHz * 4294967296ull / rate);
+
+	uint32_t h = head.load(std::memory_order_relaxed);
+	uint32_t queued = h - tail.load(std::memory_order_acquire);
+	uint32_t room = limit > queued ? limit - queued : 0;
+	uint32_t fit = n < room ? n : room;
+	for (uint32_t i = 0; i < fit; i++) {
+		int16_t s = 0;
+		if (i < tone) {
+			bool high = pattern
+				? (pattern[phase >> 28] >> (7 - ((phase >> 25) & 0x7))) & 0x1
+				: phase < 0x80000000u;
+			s = high ? amplitude : (int16_t)-amplitude;
+			phase += step;
+		}
+		ring[(h + i) & mask] = s;
+	}
+	// Dropped samples still move the oscillator, so the tone stays in phase
+	if (tone > fit)
+		phase += step * (tone - fit);
+	head.store(h + fit, std::memory_order_release);
+	produced.fetch_add(fit, std::memory_order_relaxed);
+	if (fit < n)
+		dropped.fetch_add(n - fit, std::memory_order_relaxed);
+	return fit;
+}
+
+size_t chip8Audio::consume(int16_t* out, size_t n) {
+	uint32_t t = tail.load(std::memory_order_relaxed);
+	uint32_t queued = head.load(std::memory_order_acquire) - t;
+	queuedSum.fetch_add(queued, std::memory_order_relaxed);
+	queuedCount.fetch_add(1, std::memory_order_relaxed);
+	size_t take = n < queued ? n : queued;
+	// Up to two copies, the ring may wrap
+	uint32_t start = t & mask;
+	size_t first = take < ring.size() - start ? take : ring.size() - start;
+	memcpy(out, &ring[start], first * sizeof(int16_t));
+	memcpy(out + first, &ring[0], (take - first) * sizeof(int16_t));
+	tail.store(t + (uint32_t)take, std::memory_order_release);
+	consumed.fetch_add(take, std::memory_order_relaxed);
+	if (take < n) {
+		memset(out + take, 0x0, (n - take) * sizeof(int16_t));
+		underruns.fetch_add(1, std::memory_order_relaxed);
+		silence.fetch_add(n - take, std::memory_order_relaxed);
+	}
+	return take;
+}
+
+void chip8Audio::stats(chip8AudioStats& out) const {
+	out.produced = produced.load(std::memory_order_relaxed);
+	out.consumed = consumed.load(std::memory_order_relaxed);
+	out.dropped = dropped.load(std::memory_order_relaxed);
+	out.underruns = underruns.load(std::memory_order_relaxed);
+	out.silence = silence.load(std::memory_order_relaxed);
+	uint32_t queued = head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	out.queuedMicros = (uint64_t)queued * 1000000 / rate;
+	uint64_t count = queuedCount.load(std::memory_order_relaxed);
+	out.meanQueuedMicros = count ? queuedSum.load(std::memory_order_relaxed) * 1000000 / count / rate : 0;
+}
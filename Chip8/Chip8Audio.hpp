@@ -0,0 +1,97 @@
+/*
+	Chip8 audio
+
+	Turns the sound timer into 16-bit mono PCM. After each emulated frame
+	the emulation thread calls produce(), which synthesizes the timer
+	ticks run since the previous call: a square tone while the sound timer
+	was running, or on XO-CHIP the 128-bit audio pattern (F002) played at
+	its FX3A pitch. The samples go into a single-producer/single-consumer
+	ring that the host's audio callback drains with consume().
+
+	The ring holds at most 'latency' milliseconds of audio. Samples that
+	do not fit (fast forward, a stalled device) are dropped rather than
+	delaying everything after them, and a callback that finds too few
+	samples gets silence for the rest. Neither side allocates or waits.
+*/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class chip8;
+
+struct chip8AudioStats {
+	// Samples synthesized, handed to the callback, and dropped because the
+	// ring held 'latency' worth already
+	uint64_t produced;
+	uint64_t consumed;
+	uint64_t dropped;
+	// consume() calls that ran dry, and the silence they padded with
+	uint64_t underruns;
+	uint64_t silence;
+	// Audio queued now, and on average when consume() ran, in microseconds
+	uint64_t queuedMicros;
+	uint64_t meanQueuedMicros;
+};
+
+class chip8Audio {
+public:
+	chip8Audio(unsigned int sampleRate = 48000, unsigned int latencyMillis = 20);
+
+	unsigned int sampleRate() const { return rate; }
+	// Square tone used outside XO-CHIP patterns
+	void setTone(unsigned int hz);
+	// Peak amplitude, 0 to 32767
+	void setVolume(unsigned int amplitude);
+
+	// Emulation thread: synthesizes the timer ticks c ran since the last
+	// call and queues them. The first call, and one after c was
+	// initialized, only takes the starting point. Returns the samples
+	// queued.
+	unsigned int produce(const chip8& c);
+
+	// Audio thread: fills out with n samples, silence past what is queued.
+	// Returns the samples that came from the ring.
+	size_t consume(int16_t* out, size_t n);
+
+	// Callable from either thread
+	void stats(chip8AudioStats& out) const;
+	// Empties the ring and the statistics. Neither side may be running.
+	void clear();
+
+private:
+	unsigned int rate;
+	// Most samples queued at once
+	uint32_t limit;
+	std::vector<int16_t> ring;
+	uint32_t mask;
+
+	// Owned by the producer
+	unsigned int toneHz;
+	int16_t amplitude;
+	bool primed;
+	uint64_t lastTicks;
+	uint64_t lastSound;
+	// Sample clock: samples per tick is rate / 60, the remainder carried
+	uint32_t tickRemainder;
+	// Oscillator position, a full period (tone) or pattern (XO-CHIP) = 2^32
+	uint32_t phase;
+
+	// Producer and consumer indices and counters on separate cache lines
+	char pad0[64];
+	std::atomic<uint32_t> head;
+	std::atomic<uint64_t> produced;
+	std::atomic<uint64_t> dropped;
+	char pad1[64];
+	std::atomic<uint32_t> tail;
+	std::atomic<uint64_t> consumed;
+	std::atomic<uint64_t> underruns;
+	std::atomic<uint64_t> silence;
+	std::atomic<uint64_t> queuedSum;
+	std::atomic<uint64_t> queuedCount;
+	char pad2[64];
+
+	// Samples in the next 'ticks' timer ticks
+	uint32_t samplesFor(uint64_t ticks);
+};
@@ -0,0 +1,599 @@
+/*
+	Chip8 lockstep batch interpreter
+*/
+#include "Chip8Batch.hpp"
+#include "Chip8.hpp"
+#include <cstring>
+#include <fstream>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Fontset, same as chip8::chip8_fontset
+static const uint8_t batch_fontset[80] = {
+	0xF0, 0x90, 0x90, 0x90, 0xF0, 0x20, 0x60, 0x20, 0x20, 0x70,
+	0xF0, 0x10, 0xF0, 0x80, 0xF0, 0xF0, 0x10, 0xF0, 0x10, 0xF0,
+	0x90, 0x90, 0xF0, 0x10, 0x10, 0xF0, 0x80, 0xF0, 0x10, 0xF0,
+	0xF0, 0x80, 0xF0, 0x90, 0xF0, 0xF0, 0x10, 0x20, 0x40, 0x40,
+	0xF0, 0x90, 0xF0, 0x90, 0xF0, 0xF0, 0x90, 0xF0, 0x10, 0xF0,
+	0xF0, 0x90, 0xF0, 0x90, 0x90, 0xE0, 0x90, 0xE0, 0x90, 0xE0,
+	0xF0, 0x80, 0x80, 0x80, 0xF0, 0xE0, 0x90, 0x90, 0x90, 0xE0,
+	0xF0, 0x80, 0xF0, 0x80, 0xF0, 0xF0, 0x80, 0xF0, 0x80, 0x80,
+};
+
+////////////// Kernels ////////////////////////////
+
+// 8XYN for one lane: VF first, then VX from the reloaded registers, like chip8
+static inline void arithLane(uint8_t fn, uint8_t* vx, const uint8_t* vy, uint8_t* vf) {
+	switch (fn) {
+	case 0x4: *vf = (uint8_t)(*vy > 0xFF - *vx); break;
+	case 0x5: *vf = (uint8_t)(*vx >= *vy); break;
+	case 0x6: *vf = *vx & 0x1; break;
+	case 0x7: *vf = (uint8_t)(*vy >= *vx); break;
+	case 0xE: *vf = (*vx & 0x80) >> 7; break;
+	}
+	switch (fn) {
+	case 0x0: *vx = *vy; break;
+	case 0x1: *vx |= *vy; break;
+	case 0x2: *vx &= *vy; break;
+	case 0x3: *vx ^= *vy; break;
+	case 0x4: *vx += *vy; break;
+	case 0x5: *vx -= *vy; break;
+	case 0x6: *vx >>= 1; break;
+	case 0x7: *vx = *vy - *vx; break;
+	case 0xE: *vx <<= 1; break;
+	}
+}
+
+// 8XYN for all lanes
+static void arithAll(uint8_t fn, uint8_t* vx, const uint8_t* vy, uint8_t* vf, unsigned int n) {
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i low7 = _mm256_set1_epi8(0x7F);
+	for (; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(vx + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(vy + i));
+		__m256i f;
+		bool flag = true;
+		switch (fn) {
+		case 0x4: {
+			// carry when the sum wrapped below VX
+			__m256i sum = _mm256_add_epi8(a, b);
+			f = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(sum, a), a), one);
+			break;
+		}
+		case 0x5: f = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one); break;
+		case 0x6: f = _mm256_and_si256(a, one); break;
+		case 0x7: f = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), one); break;
+		case 0xE: f = _mm256_and_si256(_mm256_srli_epi16(a, 7), one); break;
+		default: f = a; flag = false; break;
+		}
+		if (flag) {
+			_mm256_storeu_si256((__m256i*)(vf + i), f);
+			// X or Y may be F
+			a = _mm256_loadu_si256((const __m256i*)(vx + i));
+			b = _mm256_loadu_si256((const __m256i*)(vy + i));
+		}
+		switch (fn) {
+		case 0x0: a = b; break;
+		case 0x1: a = _mm256_or_si256(a, b); break;
+		case 0x2: a = _mm256_and_si256(a, b); break;
+		case 0x3: a = _mm256_xor_si256(a, b); break;
+		case 0x4: a = _mm256_add_epi8(a, b); break;
+		case 0x5: a = _mm256_sub_epi8(a, b); break;
+		case 0x6: a = _mm256_and_si256(_mm256_srli_epi16(a, 1), low7); break;
+		case 0x7: a = _mm256_sub_epi8(b, a); break;
+		case 0xE: a = _mm256_add_epi8(a, a); break;
+		}
+		_mm256_storeu_si256((__m256i*)(vx + i), a);
+	}
+#endif
+	for (; i < n; i++)
+		arithLane(fn, vx + i, vy + i, vf + i);
+}
+
+// 7XNN for all lanes
+static void addAll(uint8_t* vx, uint8_t nn, unsigned int n) {
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	const __m256i k = _mm256_set1_epi8((char)nn);
+	for (; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_loadu_si256((const __m256i*)(vx + i));
+		_mm256_storeu_si256((__m256i*)(vx + i), _mm256_add_epi8(a, k));
+	}
+#endif
+	for (; i < n; i++)
+		vx[i] += nn;
+}
+
+// Moves the 60 Hz accumulator of n lanes forward by one instruction,
+// ticking the timers of the lanes that roll over
+static void clockLanes(uint32_t* acc, uint8_t* delay, uint8_t* sound, uint8_t* beep, unsigned int clock, unsigned int n) {
+	for (unsigned int i = 0; i < n; i++) {
+		uint32_t t = acc[i] + 60;
+		if (t < clock) {
+			acc[i] = t;
+			continue;
+		}
+		acc[i] = t - clock;
+		if (delay[i] > 0)
+			--delay[i];
+		if (sound[i] > 0) {
+			if (sound[i] == 1)
+				beep[i] = 1;
+			--sound[i];
+		}
+	}
+}
+
+////////////// Batch ////////////////////////////
+
+chip8Batch::chip8Batch(unsigned int lanes) : count(lanes) {
+	V.resize(16 * count);
+	stack.resize(16 * count);
+	RPL.resize(8 * count);
+	gfx.resize(128 * count);
+	pc.resize(count);
+	opcode.resize(count);
+	I.resize(count);
+	keys.resize(count);
+	keysTaken.resize(count);
+	sp.resize(count);
+	delay_timer.resize(count);
+	sound_timer.resize(count);
+	beepFlag.resize(count);
+	exitFlag.resize(count);
+	fullscreen.resize(count);
+	drawFlag.resize(count);
+	awaitKey.resize(count);
+	rng.resize(count);
+	memory.resize(4096 * count);
+	pending.resize(count);
+	timerClock.resize(count);
+	clockSpeed = 600;
+	for (unsigned int l = 0; l < count; l++)
+		seed(l, l + 1);
+	initialize();
+}
+
+void chip8Batch::initialize() {
+	memset(image, 0x0, 4096);
+	memcpy(image, batch_fontset, 80);
+	memset(written, 0x0, 4096);
+	for (unsigned int l = 0; l < count; l++) {
+		memcpy(mem(l), image, 4096);
+		pc[l] = 0x200;
+	}
+	memset(V.data(), 0x0, V.size());
+	memset(stack.data(), 0x0, stack.size() * sizeof(uint16_t));
+	memset(RPL.data(), 0x0, RPL.size());
+	memset(gfx.data(), 0x0, gfx.size() * sizeof(uint64_t));
+	memset(I.data(), 0x0, count * sizeof(uint16_t));
+	memset(opcode.data(), 0x0, count * sizeof(uint16_t));
+	memset(keys.data(), 0x0, count * sizeof(uint16_t));
+	memset(keysTaken.data(), 0x0, count * sizeof(uint16_t));
+	memset(sp.data(), 0x0, count);
+	memset(delay_timer.data(), 0x0, count);
+	memset(sound_timer.data(), 0x0, count);
+	memset(beepFlag.data(), 0x0, count);
+	memset(exitFlag.data(), 0x0, count);
+	memset(fullscreen.data(), 0x0, count);
+	memset(drawFlag.data(), 0x0, count);
+	memset(awaitKey.data(), 0x0, count);
+	memset(timerClock.data(), 0x0, count * sizeof(uint32_t));
+	lockstepSteps = 0;
+	divergentSteps = 0;
+}
+
+bool chip8Batch::loadGame(const char* game) {
+	std::ifstream in(game, std::ios::in | std::ios::binary);
+	if (!in) return false;
+	in.seekg(0, in.end);
+	int size = (int)in.tellg();
+	if (size > 0xFFF - 0x200) return false;
+	in.seekg(0, in.beg);
+	in.read((char*)&image[0x200], size);
+	for (unsigned int l = 0; l < count; l++)
+		memcpy(mem(l), image, 4096);
+	return true;
+}
+
+const char* chip8Batch::kernels() {
+#if defined(__AVX2__)
+	return "avx2";
+#else
+	return "sse2/scalar";
+#endif
+}
+
+void chip8Batch::seed(unsigned int lane, uint32_t value) {
+	rng[lane] = value ? value : 0x2545F491;
+}
+
+void chip8Batch::setClockSpeed(unsigned int ips) {
+	clockSpeed = ips < 60 ? 60 : ips;
+	for (unsigned int l = 0; l < count; l++)
+		timerClock[l] %= clockSpeed;
+}
+
+void chip8Batch::setKeys(unsigned int lane, uint16_t k) {
+	keys[lane] = k;
+	keysTaken[lane] &= k;
+}
+
+uint8_t chip8Batch::random(unsigned int lane) {
+	uint32_t s = rng[lane];
+	s ^= s << 13;
+	s ^= s >> 17;
+	s ^= s << 5;
+	rng[lane] = s;
+	return (uint8_t)(s % 0xFF);
+}
+
+void chip8Batch::markWritten(unsigned short addr, unsigned short len) {
+	for (unsigned int i = 0; i < len; i++)
+		written[(addr + i) & 0xFFF] = 1;
+}
+
+void chip8Batch::exportLane(unsigned int lane, chip8& out) const {
+	out.pc = pc[lane];
+	out.opcode = opcode[lane];
+	out.rng = rng[lane];
+	out.I = I[lane];
+	out.sp = sp[lane];
+	out.delay_timer = delay_timer[lane];
+	out.sound_timer = sound_timer[lane];
+	out.beepFlag = beepFlag[lane] != 0;
+	out.exitFlag = exitFlag[lane] != 0;
+	out.fullscreen = fullscreen[lane] != 0;
+	out.drawFlag = drawFlag[lane] != 0;
+	out.awaitKey = awaitKey[lane] != 0;
+	out.clockSpeed = clockSpeed;
+	out.keys = keys[lane];
+	out.keysTaken = keysTaken[lane];
+	out.timerClock = timerClock[lane];
+	for (int r = 0; r < 16; r++) {
+		out.V[r] = V[r * count + lane];
+		out.stack[r] = stack[r * count + lane];
+	}
+	for (int r = 0; r < 8; r++)
+		out.RPL[r] = RPL[r * count + lane];
+	for (int w = 0; w < 128; w++)
+		out.gfx[w] = gfx[w * count + lane];
+	memcpy(out.memory, &memory[lane * 4096], 4096);
+	out.invalidate(0x0, 4096);
+}
+
+void chip8Batch::unpackGfx(unsigned int lane, unsigned char* out) const {
+	for (int i = 0; i < 128 * 64; i++)
+		out[i] = (gfx[(i >> 6) * count + lane] >> (63 - (i & 63))) & 0x1;
+}
+
+void chip8Batch::emulateCycles(unsigned int cycles) {
+	for (unsigned int l = 0; l < count; l++)
+		pending[l] = cycles;
+	while (true) {
+		// Lowest pc among lanes with cycles left
+		uint16_t p = 0xFFFF;
+		uint16_t diff = 0;
+		unsigned int active = 0;
+		for (unsigned int l = 0; l < count; l++) {
+			if (!pending[l] || exitFlag[l])
+				continue;
+			if (active)
+				diff |= pc[l] ^ p;
+			p = pc[l] < p ? pc[l] : p;
+			active++;
+		}
+		if (!active)
+			break;
+		uint16_t a = p & 0xFFF;
+		uint16_t b = (p + 1) & 0xFFF;
+		if (!diff && active == count && !written[a] && !written[b]) {
+			// Lockstep: decode once from the shared image
+			unsigned short op = image[a] << 8 | image[b];
+			if (!executeAll(op)) {
+				for (unsigned int l = 0; l < count; l++)
+					executeLane(l, op);
+			}
+			clockLanes(timerClock.data(), delay_timer.data(), sound_timer.data(), beepFlag.data(), clockSpeed, count);
+			for (unsigned int l = 0; l < count; l++) {
+				opcode[l] = op;
+				pending[l]--;
+			}
+			lockstepSteps++;
+		}
+		else {
+			// Only the lanes furthest behind run, so the others can catch up
+			for (unsigned int l = 0; l < count; l++) {
+				if (!pending[l] || exitFlag[l] || pc[l] != p)
+					continue;
+				uint8_t* m = mem(l);
+				opcode[l] = m[a] << 8 | m[b];
+				executeLane(l, opcode[l]);
+				clockLanes(&timerClock[l], &delay_timer[l], &sound_timer[l], &beepFlag[l], clockSpeed, 1);
+				pending[l]--;
+			}
+			divergentSteps++;
+		}
+	}
+}
+
+bool chip8Batch::executeAll(unsigned short op) {
+	uint8_t x = (op & 0x0F00) >> 8;
+	uint8_t y = (op & 0x00F0) >> 4;
+	uint8_t nn = op & 0x00FF;
+	uint16_t nnn = op & 0x0FFF;
+	unsigned int n = count;
+	uint16_t* p = pc.data();
+	uint8_t* vx = reg(x);
+	uint8_t* vy = reg(y);
+	switch (op & 0xF000) {
+	case 0x1000:
+		for (unsigned int l = 0; l < n; l++)
+			p[l] = nnn;
+		return true;
+	case 0x3000:
+		for (unsigned int l = 0; l < n; l++)
+			p[l] += 2 + 2 * (uint8_t)(vx[l] == nn);
+		return true;
+	case 0x4000:
+		for (unsigned int l = 0; l < n; l++)
+			p[l] += 2 + 2 * (uint8_t)(vx[l] != nn);
+		return true;
+	case 0x5000:
+		for (unsigned int l = 0; l < n; l++)
+			p[l] += 2 + 2 * (uint8_t)(vx[l] == vy[l]);
+		return true;
+	case 0x9000:
+		for (unsigned int l = 0; l < n; l++)
+			p[l] += 2 + 2 * (uint8_t)(vx[l] != vy[l]);
+		return true;
+	case 0x6000:
+		memset(vx, nn, n);
+		break;
+	case 0x7000:
+		addAll(vx, nn, n);
+		break;
+	case 0x8000: {
+		uint8_t fn = op & 0x000F;
+		if (fn > 0x7 && fn != 0xE)
+			return false;
+		arithAll(fn, vx, vy, reg(0xF), n);
+		break;
+	}
+	case 0xA000:
+		for (unsigned int l = 0; l < n; l++)
+			I[l] = nnn;
+		break;
+	case 0xC000:
+		for (unsigned int l = 0; l < n; l++)
+			vx[l] = random(l) & nn;
+		break;
+	case 0xF000:
+		switch (nn) {
+		case 0x07:
+			memcpy(vx, delay_timer.data(), n);
+			break;
+		case 0x15:
+			memcpy(delay_timer.data(), vx, n);
+			break;
+		case 0x18:
+			memcpy(sound_timer.data(), vx, n);
+			break;
+		case 0x1E:
+			for (unsigned int l = 0; l < n; l++) {
+				I[l] += vx[l];
+				if (I[l] > 0xFFF)
+					reg(0xF)[l] = 1;
+			}
+			break;
+		case 0x29:
+			for (unsigned int l = 0; l < n; l++)
+				I[l] = vx[l] * 0x5;
+			break;
+		case 0x30:
+			for (unsigned int l = 0; l < n; l++)
+				I[l] = vx[l] * 0xA;
+			break;
+		default:
+			return false;
+		}
+		break;
+	default:
+		return false;
+	}
+	for (unsigned int l = 0; l < n; l++)
+		p[l] += 2;
+	return true;
+}
+
+// Scalar interpreter over the lane's slice of the arrays, decoding like chip8
+void chip8Batch::executeLane(unsigned int lane, unsigned short op) {
+	uint8_t x = (op & 0x0F00) >> 8;
+	uint8_t y = (op & 0x00F0) >> 4;
+	uint8_t n = op & 0x000F;
+	uint8_t nn = op & 0x00FF;
+	uint16_t nnn = op & 0x0FFF;
+	uint8_t* m = mem(lane);
+	uint8_t& vx = V[x * count + lane];
+	uint8_t& vy = V[y * count + lane];
+	uint8_t& vf = V[0xF * count + lane];
+	uint16_t& p = pc[lane];
+	uint16_t& i = I[lane];
+	uint8_t wpr = 1 + fullscreen[lane];
+	uint8_t h = 32 + 32 * fullscreen[lane];
+	uint64_t* g = &gfx[lane];
+	switch (op & 0xF000) {
+	case 0x0000:
+		if (y == 0xF) {
+			switch (n) {
+			case 0xB:
+				for (uint16_t r = 0; r < wpr * h; r += wpr) {
+					for (uint16_t j = r + wpr - 1; j > r; j--)
+						g[j * count] = (g[j * count] >> 4) | (g[(j - 1) * count] << 60);
+					g[r * count] >>= 4;
+				}
+				break;
+			case 0xC:
+				for (uint16_t r = 0; r < wpr * h; r += wpr) {
+					for (uint16_t j = r; j < r + wpr - 1; j++)
+						g[j * count] = (g[j * count] << 4) | (g[(j + 1) * count] >> 60);
+					g[(r + wpr - 1) * count] <<= 4;
+				}
+				break;
+			case 0xD: exitFlag[lane] = 1; break;
+			case 0xE: fullscreen[lane] = 0; break;
+			case 0xF: fullscreen[lane] = 1; break;
+			}
+			// Scrolls and mode switches redraw, as in chip8
+			if (n == 0xB || n == 0xC || n == 0xE || n == 0xF)
+				drawFlag[lane] = 1;
+		}
+		else if (y == 0xC) {
+			uint16_t shift = wpr * n;
+			for (int j = wpr * h - 1; j >= shift; j--)
+				g[j * count] = g[(j - shift) * count];
+			for (int j = 0; j < shift; j++)
+				g[j * count] = 0;
+			drawFlag[lane] = 1;
+		}
+		else if (n == 0x0) {
+			for (int j = 0; j < 128; j++)
+				g[j * count] = 0;
+			drawFlag[lane] = 1;
+		}
+		else if (n == 0xE) {
+			--sp[lane];
+			p = stack[sp[lane] * count + lane];
+		}
+		p += 2;
+		return;
+	case 0x1000:
+		p = nnn;
+		return;
+	case 0x2000:
+		stack[sp[lane] * count + lane] = p;
+		++sp[lane];
+		p = nnn;
+		return;
+	case 0x3000: p += 2 + 2 * (uint8_t)(vx == nn); return;
+	case 0x4000: p += 2 + 2 * (uint8_t)(vx != nn); return;
+	case 0x5000: p += 2 + 2 * (uint8_t)(vx == vy); return;
+	case 0x9000: p += 2 + 2 * (uint8_t)(vx != vy); return;
+	case 0x6000: vx = nn; break;
+	case 0x7000: vx += nn; break;
+	case 0x8000:
+		if (n <= 0x7 || n == 0xE)
+			arithLane(n, &vx, &vy, &vf);
+		break;
+	case 0xA000: i = nnn; break;
+	case 0xB000:
+		p = nnn + V[lane];
+		return;
+	case 0xC000: vx = random(lane) & nn; break;
+	case 0xD000: drawLane(lane, vx, vy, n); break;
+	case 0xE000:
+		// Selected by the Y nibble only, like chip8Classify
+		if (y == 0x9) {
+			p += 2 + 2 * (uint8_t)(vx < 16 && ((keys[lane] >> vx) & 0x1));
+			return;
+		}
+		if (y == 0xA) {
+			p += 2 + 2 * (uint8_t)(vx >= 16 || ((keys[lane] >> vx) & 0x1) == 0);
+			return;
+		}
+		break;
+	case 0xF000:
+		switch (nn) {
+		case 0x07: vx = delay_timer[lane]; break;
+		case 0x0A:
+			// Highest newly pressed key wins, as in chip8::cpuFX0A
+			if (!(keys[lane] & ~keysTaken[lane])) {
+				awaitKey[lane] = 1;
+				return;
+			}
+			for (uint8_t k = 0; k < 0x10; k++) {
+				if (((keys[lane] & ~keysTaken[lane]) >> k) & 0x1)
+					vx = k;
+			}
+			keysTaken[lane] |= 1 << vx;
+			break;
+		case 0x15: delay_timer[lane] = vx; break;
+		case 0x18: sound_timer[lane] = vx; break;
+		case 0x1E:
+			i += vx;
+			if (i > 0xFFF)
+				vf = 1;
+			break;
+		case 0x29: i = vx * 0x5; break;
+		case 0x30: i = vx * 0xA; break;
+		case 0x33:
+			m[i & 0xFFF] = vx / 100;
+			m[(i + 1) & 0xFFF] = (vx / 10) % 10;
+			m[(i + 2) & 0xFFF] = vx % 10;
+			markWritten(i, 3);
+			break;
+		case 0x55:
+			for (uint8_t r = 0; r <= x; r++)
+				m[(i + r) & 0xFFF] = V[r * count + lane];
+			markWritten(i, x + 1);
+			break;
+		case 0x65:
+			for (uint8_t r = 0; r <= x; r++)
+				V[r * count + lane] = m[(i + r) & 0xFFF];
+			break;
+		case 0x75:
+			for (uint8_t r = 0; r <= x && r <= 7; r++)
+				RPL[r * count + lane] = V[r * count + lane];
+			break;
+		case 0x85:
+			for (uint8_t r = 0; r <= x && r <= 7; r++)
+				V[r * count + lane] = RPL[r * count + lane];
+			break;
+		default:
+			if (x == 0x0)
+				i = nn;
+			break;
+		}
+		break;
+	}
+	p += 2;
+}
+
+void chip8Batch::drawLane(unsigned int lane, uint8_t x, uint8_t y, uint8_t n) {
+	uint8_t* m = mem(lane);
+	uint64_t* g = &gfx[lane];
+	uint8_t& vf = V[0xF * count + lane];
+	uint16_t i = I[lane];
+	bool ext = fullscreen[lane] != 0;
+	uint16_t w = 64 + 64 * (uint8_t)ext;
+	uint16_t size = w * (32 + 32 * (uint8_t)ext);
+	uint16_t words = size / 64;
+	uint8_t bigSprite = (uint8_t)(ext && n == 0x0);
+	uint16_t spr_width = 0x8 + 0x8 * bigSprite;
+	uint16_t spr_height = (n == 0x0) ? 0x10 : n;
+
+	vf = 0;
+	for (uint16_t yline = 0; yline < spr_height; yline++) {
+		uint64_t pixel;
+		if (bigSprite)
+			pixel = m[(i + yline * 2) & 0xFFF] << 8 | m[(i + yline * 2 + 1) & 0xFFF];
+		else
+			pixel = m[(i + yline) & 0xFFF];
+		pixel <<= 64 - spr_width;
+		uint16_t idx = (x + ((y + yline) * w)) % size;
+		uint16_t word = idx >> 6;
+		uint16_t next = (word + 1) % words;
+		uint8_t bit = idx & 63;
+		uint64_t first = pixel >> bit;
+		uint64_t second = bit ? pixel << (64 - bit) : 0;
+		if ((g[word * count] & first) | (g[next * count] & second))
+			vf = 1;
+		g[word * count] ^= first;
+		g[next * count] ^= second;
+	}
+	drawFlag[lane] = 1;
+}
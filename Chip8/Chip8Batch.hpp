@@ -0,0 +1,90 @@
+/*
+	Chip8 lockstep batch interpreter
+
+	Runs many instances of the same ROM with the state of every instance
+	stored as struct-of-arrays (one array per register, indexed by lane).
+	While all lanes share a pc the opcode is decoded once and executed for
+	every lane by vector kernels. Once they diverge, only the lanes at the
+	lowest pc are stepped, one by one, until the others catch up.
+
+	The kernels are plain loops the compiler vectorizes for the target,
+	SSE2 on a default x86-64 build and AVX2 with CHIP8_AVX2. The gain over
+	separate chip8 objects depends on CHIP8_AVX2: on the Chip8Bench batch
+	ROM about 1.0-1.1x without it and 1.1-1.3x with it. It shrinks as lanes
+	spend time apart; ROMs that diverge early can run slower.
+*/
+#pragma once
+#include <cstdint>
+#include <vector>
+
+class chip8;
+
+class chip8Batch {
+public:
+	chip8Batch(unsigned int lanes);
+	void initialize();
+	// Loads the same ROM into every lane
+	bool loadGame(const char* game);
+	// Runs 'cycles' instructions on every lane that has not exited.
+	// A lane waiting on FX0A keeps spending its cycles on the wait.
+	void emulateCycles(unsigned int cycles);
+
+	unsigned int lanes() const { return count; }
+	// "avx2" or "sse2/scalar", the kernels the core was built with
+	static const char* kernels();
+	// Per lane CXNN generator seed (xorshift32, 0 is replaced)
+	void seed(unsigned int lane, uint32_t value);
+	// Instructions per emulated second, as chip8::setClockSpeed
+	void setClockSpeed(unsigned int ips);
+	// Bit k set = key k pressed
+	void setKeys(unsigned int lane, uint16_t keys);
+	bool exited(unsigned int lane) const { return exitFlag[lane] != 0; }
+	// Copies one lane into a chip8 instance, used as the per-lane reference
+	void exportLane(unsigned int lane, chip8& out) const;
+	// Same layout as chip8::unpackGfx
+	void unpackGfx(unsigned int lane, unsigned char* out) const;
+
+	// Steps executed with every lane on the same pc / for a group of lanes
+	uint64_t lockstepSteps;
+	uint64_t divergentSteps;
+
+private:
+	unsigned int count;
+
+	// Registers, [register * count + lane]
+	std::vector<uint8_t> V;
+	std::vector<uint16_t> stack;
+	std::vector<uint8_t> RPL;
+	std::vector<uint64_t> gfx;
+	// One entry per lane
+	std::vector<uint16_t> pc, I, keys;
+	// Last instruction each lane executed, as chip8::opcode
+	std::vector<uint16_t> opcode;
+	// Held keys FX0A already returned, as chip8::keysTaken
+	std::vector<uint16_t> keysTaken;
+	std::vector<uint8_t> sp, delay_timer, sound_timer;
+	std::vector<uint8_t> beepFlag, exitFlag, fullscreen;
+	// As chip8::drawFlag (screen changed) and chip8::awaitKey (FX0A waited)
+	std::vector<uint8_t> drawFlag, awaitKey;
+	std::vector<uint32_t> rng;
+	// 60 Hz timer accumulators, as chip8::timerClock
+	std::vector<uint32_t> timerClock;
+	unsigned int clockSpeed;
+	// Instructions each lane still has to run in emulateCycles
+	std::vector<unsigned int> pending;
+	// 4 KB per lane
+	std::vector<uint8_t> memory;
+	// Image every lane started from, and addresses any lane has written
+	uint8_t image[4096];
+	uint8_t written[4096];
+
+	uint8_t* reg(uint8_t x) { return &V[x * count]; }
+	uint8_t* mem(unsigned int lane) { return &memory[lane * 4096]; }
+	uint8_t random(unsigned int lane);
+	void markWritten(unsigned short addr, unsigned short len);
+
+	// Tries to run op on every lane at once, false if it needs per-lane execution
+	bool executeAll(unsigned short op);
+	void executeLane(unsigned int lane, unsigned short op);
+	void drawLane(unsigned int lane, uint8_t x, uint8_t y, uint8_t n);
+};
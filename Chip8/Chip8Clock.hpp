@@ -0,0 +1,15 @@
+/*
+	Chip8 host clock
+
+	Steady clock nanoseconds, the time base of input arrival (chip8InputEvent),
+	frame publishing (chip8FrameBuffer) and the shared-memory viewer
+	(chip8Shm), so their timestamps compare across threads and processes.
+*/
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+inline uint64_t chip8Now() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
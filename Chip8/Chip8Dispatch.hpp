@@ -0,0 +1,133 @@
+/*
+	Chip8 opcode dispatch
+
+	Every 16-bit opcode maps to the id of its final handler through one
+	64 KB table built at compile time; chip8::dispatchOp switches on the id.
+*/
+#pragma once
+
+enum chip8Handler : unsigned char {
+	op0NNN, op00CN, op00E0, op00EE, op00FB, op00FC, op00FD, op00FE, op00FF,
+	op1NNN, op2NNN, op3XNN, op4XNN, op5XY0, op6XNN, op7XNN,
+	op8XY0, op8XY1, op8XY2, op8XY3, op8XY4, op8XY5, op8XY6, op8XY7, op8XYE,
+	op9XY0, opANNN, opBNNN, opCXNN, opDXYN, opEX9E, opEXA1,
+	opF0NN, opFX07, opFX0A, opFX15, opFX18, opFX1E, opFX29, opFX30,
+	opFX33, opFX3A, opFX55, opFX65, opFX75, opFX85, opNULL,
+	chip8HandlerCount
+};
+
+constexpr chip8Handler chip8Classify(unsigned int op) {
+	switch (op >> 12) {
+	case 0x0:
+		// Only the low byte is decoded
+		switch ((op & 0x00F0) >> 4) {
+		case 0xF: {
+			const chip8Handler screen[] = { op00FB, op00FC, op00FD, op00FE, op00FF };
+			return (op & 0x000F) >= 0xB ? screen[(op & 0x000F) - 0xB] : opNULL;
+		}
+		case 0xC: return op00CN;
+		default:
+			switch (op & 0x000F) {
+			case 0x0: return op00E0;
+			case 0xE: return op00EE;
+			default: return opNULL;
+			}
+		}
+	case 0x1: return op1NNN;
+	case 0x2: return op2NNN;
+	case 0x3: return op3XNN;
+	case 0x4: return op4XNN;
+	case 0x5: return op5XY0;
+	case 0x6: return op6XNN;
+	case 0x7: return op7XNN;
+	case 0x8: {
+		const chip8Handler arithmetic[] = {
+			op8XY0, op8XY1, op8XY2, op8XY3, op8XY4, op8XY5, op8XY6, op8XY7,
+			opNULL, opNULL, opNULL, opNULL, opNULL, opNULL, op8XYE, opNULL,
+		};
+		return arithmetic[op & 0x000F];
+	}
+	case 0x9: return op9XY0;
+	case 0xA: return opANNN;
+	case 0xB: return opBNNN;
+	case 0xC: return opCXNN;
+	case 0xD: return opDXYN;
+	case 0xE:
+		// Selected by the Y nibble only
+		switch ((op & 0x00F0) >> 4) {
+		case 0x9: return opEX9E;
+		case 0xA: return opEXA1;
+		default: return opNULL;
+		}
+	default:
+		switch (op & 0x00FF) {
+		case 0x07: return opFX07;
+		case 0x0A: return opFX0A;
+		case 0x15: return opFX15;
+		case 0x18: return opFX18;
+		case 0x1E: return opFX1E;
+		case 0x29: return opFX29;
+		case 0x30: return opFX30;
+		case 0x33: return opFX33;
+		case 0x3A: return opFX3A;
+		case 0x55: return opFX55;
+		case 0x65: return opFX65;
+		case 0x75: return opFX75;
+		case 0x85: return opFX85;
+		default: return (op & 0x0F00) == 0 ? opF0NN : opNULL;
+		}
+	}
+}
+
+struct chip8DispatchTable {
+	unsigned char id[0x10000];
+
+	constexpr chip8DispatchTable() : id() {
+		for (unsigned int op = 0; op < 0x10000; op++)
+			id[op] = chip8Classify(op);
+	}
+};
+
+// Opcode sequences the threaded interpreter runs as one handler, see
+// chip8::runFused. The results are those of running them one at a time.
+enum chip8Fusion : unsigned char {
+	fuseNone,
+	fuseANNN_DXYN,          // point and draw
+	fuse6XNN_6XNN,          // coordinate setup
+	fuse7XNN_3XNN_1NNN,     // counted loops
+	fuse7XNN_4XNN_1NNN,
+	fuseFX33_FX65,          // BCD print
+	chip8FusionCount,
+	// Decoded, the instructions after it not looked at yet
+	fuseUnchecked = chip8FusionCount
+};
+
+// Fusion starting at an instruction with handler a, followed by b and c
+constexpr chip8Fusion chip8Fuse(chip8Handler a, chip8Handler b, chip8Handler c) {
+	switch (a) {
+	case opANNN: return b == opDXYN ? fuseANNN_DXYN : fuseNone;
+	case op6XNN: return b == op6XNN ? fuse6XNN_6XNN : fuseNone;
+	case op7XNN:
+		if (c != op1NNN)
+			return fuseNone;
+		return b == op3XNN ? fuse7XNN_3XNN_1NNN : b == op4XNN ? fuse7XNN_4XNN_1NNN : fuseNone;
+	case opFX33: return b == opFX65 ? fuseFX33_FX65 : fuseNone;
+	default: return fuseNone;
+	}
+}
+
+// Instructions a fusion runs at most
+constexpr unsigned int chip8FusionLength(chip8Fusion f) {
+	return f == fuse7XNN_3XNN_1NNN || f == fuse7XNN_4XNN_1NNN ? 3 : 2;
+}
+
+constexpr const char* chip8FusionName(chip8Fusion f) {
+	switch (f) {
+	case fuseANNN_DXYN: return "ANNN+DXYN";
+	case fuse6XNN_6XNN: return "6XNN+6XNN";
+	case fuse7XNN_3XNN_1NNN: return "7XNN+3XNN+1NNN";
+	case fuse7XNN_4XNN_1NNN: return "7XNN+4XNN+1NNN";
+	case fuseFX33_FX65: return "FX33+FX65";
+	default: return "none";
+	}
+}
@@ -0,0 +1,114 @@
+/*
+	Chip8 frame handoff
+*/
+#include "Chip8Frames.hpp"
+#include "Chip8Clock.hpp"
+#include <cstring>
+
+// Grows a to cover b as well
+static void mergeDamage(chip8Damage& a, const chip8Damage& b) {
+	if (b.rows == 0)
+		return;
+	if (a.rows == 0) {
+		a.rows = b.rows;
+		a.left = b.left;
+		a.top = b.top;
+		a.right = b.right;
+		a.bottom = b.bottom;
+		return;
+	}
+	a.rows |= b.rows;
+	if (b.left < a.left)
+		a.left = b.left;
+	if (b.top < a.top)
+		a.top = b.top;
+	if (b.right > a.right)
+		a.right = b.right;
+	if (b.bottom > a.bottom)
+		a.bottom = b.bottom;
+}
+
+chip8FrameBuffer::chip8FrameBuffer() {
+	clear();
+}
+
+void chip8FrameBuffer::clear() {
+	memset(slots, 0x0, sizeof(slots));
+	memset(&pending, 0x0, sizeof(pending));
+	front = 0;
+	back = 2;
+	sequence = 0;
+	latencySum = 0;
+	middle.store(1, std::memory_order_relaxed);
+	produced.store(0, std::memory_order_relaxed);
+	dropped.store(0, std::memory_order_relaxed);
+	skipped.store(0, std::memory_order_relaxed);
+	lastPublished.store(0, std::memory_order_relaxed);
+	intervalSum.store(0, std::memory_order_relaxed);
+	consumed.store(0, std::memory_order_relaxed);
+	lastLatency.store(0, std::memory_order_relaxed);
+	meanLatency.store(0, std::memory_order_release);
+}
+
+bool chip8FrameBuffer::publish(chip8& c, bool always) {
+	chip8Damage d;
+	c.takeDamage(d);
+	// Unchanged means equal to the last published frame as well, skipped
+	// frames in between having been equal to it too
+	if (!d.changed && !always && sequence > 0) {
+		skipped.store(skipped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return false;
+	}
+	// The previous frame may still be unread, the consumer then needs its
+	// changes too. If it is picked up before the exchange below the union
+	// only over-reports.
+	if (middle.load(std::memory_order_acquire) & FRESH)
+		mergeDamage(d, pending);
+	pending = d;
+
+	chip8Frame& f = slots[back];
+	memcpy(f.gfx, c.gfx, sizeof(f.gfx));
+	f.fullscreen = c.fullscreen;
+	f.damage = d;
+	f.sequence = ++sequence;
+	f.published = chip8Now();
+
+	unsigned int previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+	back = previous & ~FRESH;
+	if (previous & FRESH)
+		dropped.store(dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	uint64_t last = lastPublished.load(std::memory_order_relaxed);
+	if (last != 0)
+		intervalSum.store(intervalSum.load(std::memory_order_relaxed) + (f.published - last), std::memory_order_relaxed);
+	lastPublished.store(f.published, std::memory_order_relaxed);
+	produced.store(sequence, std::memory_order_release);
+	return true;
+}
+
+const chip8Frame* chip8FrameBuffer::acquire(bool& fresh) {
+	fresh = (middle.load(std::memory_order_relaxed) & FRESH) != 0;
+	if (fresh) {
+		front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+		uint64_t latency = chip8Now() - slots[front].published;
+		uint64_t n = consumed.load(std::memory_order_relaxed) + 1;
+		latencySum += latency;
+		lastLatency.store(latency, std::memory_order_relaxed);
+		meanLatency.store(latencySum / n, std::memory_order_relaxed);
+		consumed.store(n, std::memory_order_release);
+	}
+	return slots[front].sequence != 0 ? &slots[front] : nullptr;
+}
+
+void chip8FrameBuffer::stats(chip8FrameStats& out) const {
+	out.produced = produced.load(std::memory_order_acquire);
+	out.consumed = consumed.load(std::memory_order_acquire);
+	out.dropped = dropped.load(std::memory_order_relaxed);
+	out.skipped = skipped.load(std::memory_order_relaxed);
+	uint64_t last = lastPublished.load(std::memory_order_relaxed);
+	uint64_t t = chip8Now();
+	out.newestAge = last != 0 && t > last ? t - last : 0;
+	out.lastLatency = lastLatency.load(std::memory_order_relaxed);
+	out.meanLatency = meanLatency.load(std::memory_order_relaxed);
+	out.meanInterval = out.produced > 1 ? intervalSum.load(std::memory_order_relaxed) / (out.produced - 1) : 0;
+}
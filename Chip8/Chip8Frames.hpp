@@ -0,0 +1,96 @@
+/*
+	Chip8 frame handoff
+
+	Triple buffer between the emulation thread (single producer) and a
+	render thread (single consumer). The producer fills its back slot and
+	swaps it with the shared middle slot in one atomic exchange; the
+	consumer swaps the middle slot with its front slot when a newer frame
+	is there. Neither side waits: a frame the consumer did not pick up in
+	time is replaced by the next one and counted as dropped, and the
+	consumer never sees a slot the producer is writing.
+*/
+#pragma once
+#include "Chip8.hpp"
+#include <atomic>
+#include <cstdint>
+
+struct chip8Frame {
+	// Copy of chip8::gfx and chip8::fullscreen
+	uint64_t gfx[128 * 64 / 64];
+	bool fullscreen;
+	// Changes since the frame the consumer acquired before this one,
+	// dropped frames included
+	chip8Damage damage;
+	// 1 for the first frame published
+	uint64_t sequence;
+	// Host time of publish(), steady clock nanoseconds
+	uint64_t published;
+};
+
+struct chip8FrameStats {
+	// Frames published and acquired
+	uint64_t produced;
+	uint64_t consumed;
+	// Published frames replaced before the consumer got to them
+	uint64_t dropped;
+	// publish() calls that found the screen unchanged and published nothing
+	uint64_t skipped;
+	// Age of the newest published frame, 0 before the first one
+	uint64_t newestAge;
+	// Publish to acquire delay of the last acquired frame and the mean
+	// over all of them
+	uint64_t lastLatency;
+	uint64_t meanLatency;
+	// Mean time between published frames
+	uint64_t meanInterval;
+};
+
+class chip8FrameBuffer {
+public:
+	chip8FrameBuffer();
+
+	// Producer side: takes the damage of c (see chip8::takeDamage) and
+	// publishes its screen. An unchanged screen is only published when
+	// 'always' is set. Returns true if a frame was published.
+	bool publish(chip8& c, bool always = false);
+
+	// Consumer side: newest published frame, valid until the next
+	// acquire(). Null before the first publish. 'fresh' tells whether it
+	// is a different frame from the previous call's.
+	const chip8Frame* acquire(bool& fresh);
+
+	// Callable from either thread; times in nanoseconds
+	void stats(chip8FrameStats& out) const;
+	// Forgets all frames and statistics. Neither side may be running.
+	void clear();
+
+private:
+	// Middle slot index plus a flag set while it holds an unread frame
+	static const unsigned int FRESH = 0x4;
+
+	chip8Frame slots[3];
+	// Owned by the producer
+	unsigned int back;
+	uint64_t sequence;
+	// Damage of frames published but possibly not acquired, folded into
+	// the next frame so the consumer never misses a region
+	chip8Damage pending;
+	// Owned by the consumer
+	unsigned int front;
+	uint64_t latencySum;
+	// Shared; the slot exchange, producer and consumer counters on
+	// separate cache lines
+	char pad0[64];
+	std::atomic<unsigned int> middle;
+	char pad1[64];
+	std::atomic<uint64_t> produced;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> skipped;
+	std::atomic<uint64_t> lastPublished;
+	std::atomic<uint64_t> intervalSum;
+	char pad2[64];
+	std::atomic<uint64_t> consumed;
+	std::atomic<uint64_t> lastLatency;
+	std::atomic<uint64_t> meanLatency;
+	char pad3[64];
+};
@@ -0,0 +1,87 @@
+/*
+	Chip8 frame hashing
+*/
+#include "Chip8Hash.hpp"
+#include <cstring>
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotl(uint64_t v, int r) {
+	return (v << r) | (v >> (64 - r));
+}
+
+// Host order loads (little-endian on every target the core builds for),
+// memcpy so unaligned input is fine
+static inline uint64_t read64(const uint8_t* p) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static inline uint64_t mixLane(uint64_t acc, uint64_t input) {
+	acc += input * PRIME2;
+	return rotl(acc, 31) * PRIME1;
+}
+
+static inline uint64_t mergeLane(uint64_t acc, uint64_t v) {
+	acc ^= mixLane(0, v);
+	return acc * PRIME1 + PRIME4;
+}
+
+uint64_t chip8Hash64(const void* data, size_t len, uint64_t seed) {
+	const uint8_t* p = (const uint8_t*)data;
+	const uint8_t* end = p + len;
+	uint64_t h;
+
+	if (len >= 32) {
+		// Four independent lanes over 32 byte stripes
+		uint64_t v1 = seed + PRIME1 + PRIME2;
+		uint64_t v2 = seed + PRIME2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - PRIME1;
+		const uint8_t* limit = end - 32;
+		do {
+			v1 = mixLane(v1, read64(p));
+			v2 = mixLane(v2, read64(p + 8));
+			v3 = mixLane(v3, read64(p + 16));
+			v4 = mixLane(v4, read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = mergeLane(h, v1);
+		h = mergeLane(h, v2);
+		h = mergeLane(h, v3);
+		h = mergeLane(h, v4);
+	}
+	else
+		h = seed + PRIME5;
+	h += (uint64_t)len;
+
+	// Tail: 8, then 4, then single bytes
+	for (; p + 8 <= end; p += 8)
+		h = rotl(h ^ mixLane(0, read64(p)), 27) * PRIME1 + PRIME4;
+	if (p + 4 <= end) {
+		h = rotl(h ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++)
+		h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+
+	// Avalanche
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
@@ -0,0 +1,11 @@
+/*
+	Chip8 frame hashing
+
+	XXH64 (xxHash, 64-bit variant), bit-compatible with the reference
+	implementation so hashes can be checked with other tools.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+uint64_t chip8Hash64(const void* data, size_t len, uint64_t seed = 0);
@@ -0,0 +1,393 @@
+/*
+	Chip8 x86-64 basic block recompiler
+
+	A block is a straight run of register/index opcodes, closed by 1NNN or
+	one of the skip opcodes, or by any opcode the recompiler does not handle
+	(2NNN, 00EE, BNNN, DXYN, FX0A, timers, memory transfers, ...), which is
+	then left to the interpreter. Compiled code works directly on the chip8
+	object passed in the first argument and returns the new pc in eax,
+	leaving opcode on the block's last instruction as the interpreter would.
+*/
+#include "Chip8Jit.hpp"
+#include "Chip8.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_JIT_X64
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+// Executable memory reserved per instance
+static const unsigned int JIT_CODE_SIZE = 1 << 20;
+// Longest block, in instructions
+static const unsigned short JIT_MAX_BLOCK = 64;
+// Worst case bytes emitted for one block
+static const unsigned int JIT_MAX_BLOCK_BYTES = 4096;
+
+// x86 registers used by the emitted code (r8 holds the chip8 pointer)
+static const uint8_t AL = 0;
+static const uint8_t DL = 2;
+
+chip8Jit::chip8Jit(chip8& owner) : c(owner) {
+	code = nullptr;
+	codeSize = 0;
+	codeUsed = 0;
+	offV = (int32_t)((char*)c.V - (char*)&c);
+	offI = (int32_t)((char*)&c.I - (char*)&c);
+	offOpcode = (int32_t)((char*)&c.opcode - (char*)&c);
+#if defined(CHIP8_JIT_X64)
+#if defined(_WIN32)
+	void* mem = VirtualAlloc(NULL, JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+#else
+	void* mem = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		mem = nullptr;
+#endif
+	if (mem) {
+		code = (uint8_t*)mem;
+		codeSize = JIT_CODE_SIZE;
+	}
+#endif
+	flush();
+}
+
+chip8Jit::~chip8Jit() {
+#if defined(CHIP8_JIT_X64)
+	if (code) {
+#if defined(_WIN32)
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, codeSize);
+#endif
+	}
+#endif
+}
+
+bool chip8Jit::available() const {
+	return code != nullptr;
+}
+
+void chip8Jit::flush() {
+	memset(blocks, 0x0, sizeof(blocks));
+	memset(covered, 0x0, sizeof(covered));
+	codeUsed = 0;
+}
+
+unsigned int chip8Jit::run(unsigned int cycles) {
+	unsigned int done = 0;
+	while (c.pc <= 0xFFE) {
+		block* b = &blocks[c.pc];
+		if (!b->tried)
+			b = &compile(c.pc);
+		if (!b->call || b->count > cycles - done)
+			break;
+		c.pc = (unsigned short)b->call(&c);
+		done += b->count;
+	}
+	return done;
+}
+
+void chip8Jit::invalidate(unsigned short addr, unsigned short len) {
+	bool hit = false;
+	// Failed compiles depend on the opcode starting one byte earlier too
+	for (unsigned int i = 0; i <= len; i++) {
+		unsigned short a = (addr + 0xFFF + i) & 0xFFF;
+		if (!blocks[a].call)
+			blocks[a].tried = false;
+		if (i > 0 && covered[a])
+			hit = true;
+	}
+	if (!hit)
+		return;
+	unsigned int lo = addr & 0xFFF;
+	unsigned int hi = lo + len;
+	for (unsigned int s = 0; s < 4096; s++) {
+		block& b = blocks[s];
+		if (b.call && s < hi && b.end > lo) {
+			for (unsigned int a = s; a < b.end; a++)
+				covered[a]--;
+			b.call = nullptr;
+			b.tried = false;
+		}
+	}
+}
+
+////////////// Compiler ////////////////////////////
+
+chip8Jit::block& chip8Jit::compile(unsigned short addr) {
+	if (code && codeUsed + JIT_MAX_BLOCK_BYTES > codeSize)
+		flush();
+	block& b = blocks[addr];
+	b.tried = true;
+	b.call = nullptr;
+	b.count = 0;
+	if (!code)
+		return b;
+
+	uint8_t* start = code + codeUsed;
+	out = start;
+	// mov r8, rcx (Win64) / mov r8, rdi (System V)
+#if defined(_WIN32)
+	emit(0x49); emit(0x89); emit(0xC8);
+#else
+	emit(0x49); emit(0x89); emit(0xF8);
+#endif
+	unsigned short pc = addr;
+	unsigned short count = 0;
+	unsigned short last = 0;
+	bool closed = false;
+	while (!closed) {
+		if (pc > 0xFFE || count == JIT_MAX_BLOCK) {
+			if (count > 0)
+				storeOpcode(last);
+			exitTo(pc);
+			break;
+		}
+		unsigned short op = c.memory[pc] << 8 | c.memory[pc + 1];
+		uint8_t x = (op & 0x0F00) >> 8;
+		uint8_t y = (op & 0x00F0) >> 4;
+		uint8_t nn = op & 0x00FF;
+		switch (op & 0xF000) {
+		case 0x1000:
+			storeOpcode(op);
+			exitTo(op & 0x0FFF);
+			closed = true;
+			break;
+		case 0x3000:
+		case 0x4000:
+			storeOpcode(op);
+			// cmp byte [r8 + VX], NN
+			emitMemOp(0x00, 0x80, 7, offV + x);
+			emit(nn);
+			exitSkip(pc, (op & 0xF000) == 0x3000 ? 0x44 : 0x45);
+			closed = true;
+			break;
+		case 0x5000:
+		case 0x9000:
+			storeOpcode(op);
+			// cmp byte [r8 + VX], dl
+			loadV(DL, y);
+			emitMemOp(0x00, 0x38, DL, offV + x);
+			exitSkip(pc, (op & 0xF000) == 0x5000 ? 0x44 : 0x45);
+			closed = true;
+			break;
+		default:
+			if (!emitOp(op)) {
+				// Nothing compiled: leave the opcode to the interpreter
+				if (count == 0)
+					return b;
+				storeOpcode(last);
+				exitTo(pc);
+				closed = true;
+				continue;
+			}
+			break;
+		}
+		last = op;
+		pc += 2;
+		count++;
+	}
+	b.count = count;
+	b.end = pc;
+	b.call = (blockCall)start;
+	codeUsed += (unsigned int)(out - start);
+	for (unsigned int a = addr; a < b.end; a++)
+		covered[a]++;
+	return b;
+}
+
+bool chip8Jit::emitOp(unsigned short op) {
+	uint8_t x = (op & 0x0F00) >> 8;
+	uint8_t y = (op & 0x00F0) >> 4;
+	uint8_t nn = op & 0x00FF;
+	switch (op & 0xF000) {
+	// 6XNN: mov byte [r8 + VX], NN
+	case 0x6000:
+		emitMemOp(0x00, 0xC6, 0, offV + x);
+		emit(nn);
+		return true;
+	// 7XNN: add byte [r8 + VX], NN
+	case 0x7000:
+		emitMemOp(0x00, 0x80, 0, offV + x);
+		emit(nn);
+		return true;
+	// ANNN: mov word [r8 + I], NNN
+	case 0xA000:
+		emitMemOp(0x66, 0xC7, 0, offI);
+		emit16(op & 0x0FFF);
+		return true;
+	case 0x8000:
+		// Shifts are only compiled for profiles that shift VX in place
+		if (((op & 0x000F) == 0x6 || (op & 0x000F) == 0xE) && chip8PlatformQuirks(c.platform).shiftVY)
+			return false;
+		// Same operation order as the interpreter so X or Y == F behave alike
+		switch (op & 0x000F) {
+		case 0x0:
+			loadV(AL, y);
+			storeV(AL, x);
+			return true;
+		case 0x1:
+		case 0x2:
+		case 0x3: {
+			static const uint8_t alu[4] = { 0x00, 0x08, 0x20, 0x30 };
+			loadV(AL, x);
+			loadV(DL, y);
+			emit(alu[op & 0x000F]); emit(0xD0);    // or/and/xor al, dl
+			storeV(AL, x);
+			return true;
+		}
+		case 0x4:
+			loadV(AL, x);
+			loadV(DL, y);
+			emit(0x00); emit(0xD0);                // add al, dl
+			emit(0x0F); emit(0x92); emit(0xC0);    // setc al
+			storeV(AL, 0xF);
+			loadV(AL, x);
+			loadV(DL, y);
+			emit(0x00); emit(0xD0);                // add al, dl
+			storeV(AL, x);
+			return true;
+		case 0x5:
+			loadV(AL, x);
+			loadV(DL, y);
+			emit(0x38); emit(0xD0);                // cmp al, dl
+			emit(0x0F); emit(0x93); emit(0xC0);    // setae al
+			storeV(AL, 0xF);
+			loadV(AL, x);
+			loadV(DL, y);
+			emit(0x28); emit(0xD0);                // sub al, dl
+			storeV(AL, x);
+			return true;
+		case 0x6:
+			loadV(AL, x);
+			emit(0x24); emit(0x01);                // and al, 1
+			storeV(AL, 0xF);
+			loadV(AL, x);
+			emit(0xD0); emit(0xE8);                // shr al, 1
+			storeV(AL, x);
+			return true;
+		case 0x7:
+			loadV(AL, x);
+			loadV(DL, y);
+			emit(0x38); emit(0xC2);                // cmp dl, al
+			emit(0x0F); emit(0x93); emit(0xC0);    // setae al
+			storeV(AL, 0xF);
+			loadV(AL, x);
+			loadV(DL, y);
+			emit(0x28); emit(0xC2);                // sub dl, al
+			storeV(DL, x);
+			return true;
+		case 0xE:
+			loadV(AL, x);
+			emit(0xC0); emit(0xE8); emit(0x07);    // shr al, 7
+			storeV(AL, 0xF);
+			loadV(AL, x);
+			emit(0xD0); emit(0xE0);                // shl al, 1
+			storeV(AL, x);
+			return true;
+		default:
+			return false;
+		}
+	case 0xF000:
+		switch (nn) {
+		// FX1E: I += VX, VF = 1 past 0xFFF
+		case 0x1E:
+			loadV(AL, x);
+			emit(0x41); emit(0x0F); emit(0xB7);    // movzx edx, word [r8 + I]
+			emit(0x90); emit32((uint32_t)offI);
+			emit(0x01); emit(0xC2);                // add edx, eax
+			emitMemOp(0x66, 0x89, DL, offI);       // mov word [r8 + I], dx
+			emit(0x0F); emit(0xB7); emit(0xD2);    // movzx edx, dx
+			emit(0x81); emit(0xFA); emit32(0xFFF); // cmp edx, 0xFFF
+			emit(0x76); emit(0x08);                // jbe +8
+			emitMemOp(0x00, 0xC6, 0, offV + 0xF);  // mov byte [r8 + VF], 1
+			emit(0x01);
+			return true;
+		// FX29 / FX30: I = VX * 5 / VX * 10
+		case 0x29:
+		case 0x30:
+			loadV(AL, x);
+			emit(0x8D); emit(0x04); emit(0x80);    // lea eax, [rax + rax * 4]
+			if (nn == 0x30) {
+				emit(0x01); emit(0xC0);            // add eax, eax
+			}
+			emitMemOp(0x66, 0x89, AL, offI);       // mov word [r8 + I], ax
+			return true;
+		default:
+			// *F0NN: I = NN, except the XO-CHIP audio opcodes
+			if (chip8PlatformQuirks(c.platform).xoAudio && (nn == 0x02 || nn == 0x3A))
+				return false;
+			if (x == 0x0 && nn != 0x07 && nn != 0x0A && nn != 0x15 && nn != 0x18 &&
+				nn != 0x33 && nn != 0x55 && nn != 0x65 && nn != 0x75 && nn != 0x85) {
+				emitMemOp(0x66, 0xC7, 0, offI);
+				emit16(nn);
+				return true;
+			}
+			return false;
+		}
+	default:
+		return false;
+	}
+}
+
+////////////// Emitters ////////////////////////////
+
+void chip8Jit::emit(uint8_t b) {
+	*out++ = b;
+}
+
+void chip8Jit::emit16(uint16_t v) {
+	emit(v & 0xFF);
+	emit(v >> 8);
+}
+
+void chip8Jit::emit32(uint32_t v) {
+	emit16(v & 0xFFFF);
+	emit16(v >> 16);
+}
+
+// [prefix] REX.B op modrm(disp32, reg, r8) disp32
+void chip8Jit::emitMemOp(uint8_t prefix, uint8_t op, uint8_t reg, int32_t disp) {
+	if (prefix)
+		emit(prefix);
+	emit(0x41);
+	emit(op);
+	emit(0x80 | (reg << 3));
+	emit32((uint32_t)disp);
+}
+
+// movzx reg, byte [r8 + VX]
+void chip8Jit::loadV(uint8_t reg, uint8_t x) {
+	emit(0x41); emit(0x0F); emit(0xB6);
+	emit(0x80 | (reg << 3));
+	emit32((uint32_t)(offV + x));
+}
+
+// mov byte [r8 + VX], reg
+void chip8Jit::storeV(uint8_t reg, uint8_t x) {
+	emitMemOp(0x00, 0x88, reg, offV + x);
+}
+
+// mov word [r8 + opcode], op
+void chip8Jit::storeOpcode(unsigned short op) {
+	emitMemOp(0x66, 0xC7, 0, offOpcode);
+	emit16(op);
+}
+
+// mov eax, target; ret
+void chip8Jit::exitTo(unsigned int target) {
+	emit(0xB8); emit32(target);
+	emit(0xC3);
+}
+
+// mov eax, pc + 2; mov edx, pc + 4; cmovcc eax, edx; ret
+void chip8Jit::exitSkip(unsigned short pc, uint8_t cmov) {
+	emit(0xB8); emit32(pc + 2);
+	emit(0xBA); emit32(pc + 4);
+	emit(0x0F); emit(cmov); emit(0xC2);
+	emit(0xC3);
+}
@@ -0,0 +1,62 @@
+/*
+	Chip8 x86-64 basic block recompiler
+*/
+#pragma once
+#include <cstdint>
+
+class chip8;
+
+class chip8Jit {
+public:
+	chip8Jit(chip8& owner);
+	~chip8Jit();
+	// True when executable memory could be allocated on an x86-64 host
+	bool available() const;
+	// Runs compiled blocks starting at pc for at most 'cycles' instructions.
+	// Returns the number of instructions executed; 0 means the interpreter
+	// has to execute the instruction at pc.
+	unsigned int run(unsigned int cycles);
+	// Drops blocks overlapping memory[addr..addr+len-1]
+	void invalidate(unsigned short addr, unsigned short len);
+	// Drops every block
+	void flush();
+
+private:
+	// Compiled block: returns the new pc, receives the owning chip8
+	typedef unsigned int(*blockCall)(chip8*);
+
+	struct block {
+		blockCall call;
+		unsigned short end;       // first byte after the block
+		unsigned short count;     // instructions in the block
+		bool tried;               // compile attempted (call may be null)
+	};
+
+	chip8& c;
+	block blocks[4096];
+	// Number of blocks covering each memory byte
+	unsigned short covered[4096];
+	uint8_t* code;
+	unsigned int codeSize;
+	unsigned int codeUsed;
+	// Offsets of the chip8 members touched by compiled code
+	int32_t offV;
+	int32_t offI;
+	int32_t offOpcode;
+
+	block& compile(unsigned short addr);
+
+	// Emitters
+	uint8_t* out;
+	void emit(uint8_t b);
+	void emit16(uint16_t v);
+	void emit32(uint32_t v);
+	void emitMemOp(uint8_t prefix, uint8_t op, uint8_t reg, int32_t disp);
+	void loadV(uint8_t reg, uint8_t x);
+	void storeV(uint8_t reg, uint8_t x);
+	void storeOpcode(unsigned short op);
+	void exitTo(unsigned int target);
+	void exitSkip(unsigned short pc, uint8_t cmov);
+	// Emits the body of a non-terminating opcode, false if unsupported
+	bool emitOp(unsigned short op);
+};
@@ -0,0 +1,266 @@
+/*
+	Chip8 input movies
+*/
+#include "Chip8Movie.hpp"
+#include "Chip8.hpp"
+#include "Chip8Hash.hpp"
+#include <fstream>
+#include <iterator>
+
+static void putInt(std::vector<uint8_t>& out, uint64_t v, int bytes) {
+	for (int i = 0; i < bytes; i++)
+		out.push_back((uint8_t)(v >> (8 * i)));
+}
+
+static void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+	while (v >= 0x80) {
+		out.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	out.push_back((uint8_t)v);
+}
+
+// Reads from [p, end), false past the end
+static bool getInt(const uint8_t*& p, const uint8_t* end, int bytes, uint64_t& v) {
+	if (end - p < bytes)
+		return false;
+	v = 0;
+	for (int i = 0; i < bytes; i++)
+		v |= (uint64_t)*p++ << (8 * i);
+	return true;
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		if (p == end)
+			return false;
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+chip8Movie::chip8Movie() {
+	rom = 0;
+	machine = platformDefault;
+	ips = 0;
+	rngSeed = 0;
+	every = 1;
+	frameCount = 0;
+	lastKeys = 0;
+}
+
+bool chip8Movie::begin(const chip8& c, uint64_t romHash, unsigned int checkpointEvery) {
+	if (c.getCycles() != 0)
+		return false;
+	rom = romHash;
+	machine = c.getPlatform();
+	ips = c.getClockSpeed();
+	rngSeed = c.getSeed();
+	every = checkpointEvery > 0 ? checkpointEvery : 1;
+	frameCount = 0;
+	lastKeys = 0;
+	keys.clear();
+	checkpoints.clear();
+	input(c);
+	return true;
+}
+
+void chip8Movie::input(const chip8& c) {
+	uint16_t k = c.getKeys();
+	if (k == lastKeys)
+		return;
+	lastKeys = k;
+	// Changed again before the core ran on: the later state stands, and
+	// none if it is the one from before
+	if (!keys.empty() && keys.back().cycle == c.getCycles()) {
+		keys.pop_back();
+		if (k == (keys.empty() ? 0 : keys.back().keys))
+			return;
+	}
+	chip8MovieKeys e;
+	e.cycle = c.getCycles();
+	e.keys = k;
+	keys.push_back(e);
+}
+
+void chip8Movie::frame(const chip8& c) {
+	frameCount++;
+	if (frameCount % every == 0)
+		checkpoint(c);
+}
+
+void chip8Movie::end(const chip8& c) {
+	if (checkpoints.empty() || checkpoints.back().frame != frameCount)
+		checkpoint(c);
+}
+
+void chip8Movie::checkpoint(const chip8& c) {
+	chip8MovieCheckpoint p;
+	p.frame = frameCount;
+	p.cycle = c.getCycles();
+	p.hash = chip8Hash64(c.gfx, sizeof(c.gfx));
+	checkpoints.push_back(p);
+}
+
+bool chip8Movie::save(const char* path) const {
+	std::vector<uint8_t> out;
+	putInt(out, CHIP8_MOVIE_MAGIC, 4);
+	putInt(out, CHIP8_MOVIE_VERSION, 4);
+	putInt(out, rom, 8);
+	putInt(out, rngSeed, 4);
+	putInt(out, ips, 4);
+	putInt(out, every, 4);
+	putInt(out, frameCount, 4);
+	putInt(out, keys.size(), 4);
+	putInt(out, checkpoints.size(), 4);
+	putInt(out, machine, 4);
+	uint64_t cycle = 0;
+	for (const chip8MovieKeys& e : keys) {
+		putVarint(out, e.cycle - cycle);
+		putInt(out, e.keys, 2);
+		cycle = e.cycle;
+	}
+	uint32_t frame = 0;
+	cycle = 0;
+	for (const chip8MovieCheckpoint& p : checkpoints) {
+		putVarint(out, p.frame - frame);
+		putVarint(out, p.cycle - cycle);
+		putInt(out, p.hash, 8);
+		frame = p.frame;
+		cycle = p.cycle;
+	}
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	file.write((const char*)out.data(), out.size());
+	return (bool)file;
+}
+
+bool chip8Movie::load(const char* path) {
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file)
+		return false;
+	std::vector<uint8_t> in((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	const uint8_t* p = in.data();
+	const uint8_t* end = p + in.size();
+	uint64_t magic, version, hash, seedValue, speed, interval, frames, keyCount, pointCount, platformId;
+	// Header: magic, version, ROM hash (8 bytes), seed, clock speed,
+	// checkpoint interval, frames, key changes, checkpoints, platform
+	if (!getInt(p, end, 4, magic) || !getInt(p, end, 4, version) || !getInt(p, end, 8, hash) ||
+		!getInt(p, end, 4, seedValue) || !getInt(p, end, 4, speed) || !getInt(p, end, 4, interval) ||
+		!getInt(p, end, 4, frames) || !getInt(p, end, 4, keyCount) || !getInt(p, end, 4, pointCount) ||
+		!getInt(p, end, 4, platformId))
+		return false;
+	if (magic != CHIP8_MOVIE_MAGIC || version != CHIP8_MOVIE_VERSION || platformId >= chip8PlatformCount)
+		return false;
+	// Every entry takes at least 3 bytes, bounds the reserves below
+	if (keyCount + pointCount > (uint64_t)(end - p) / 3)
+		return false;
+
+	std::vector<chip8MovieKeys> k;
+	std::vector<chip8MovieCheckpoint> c;
+	k.reserve((size_t)keyCount);
+	c.reserve((size_t)pointCount);
+	uint64_t cycle = 0, delta, v;
+	for (uint64_t i = 0; i < keyCount; i++) {
+		if (!getVarint(p, end, delta) || !getInt(p, end, 2, v))
+			return false;
+		cycle += delta;
+		chip8MovieKeys e;
+		e.cycle = cycle;
+		e.keys = (uint16_t)v;
+		k.push_back(e);
+	}
+	uint64_t frame = 0, frameDelta;
+	cycle = 0;
+	for (uint64_t i = 0; i < pointCount; i++) {
+		if (!getVarint(p, end, frameDelta) || !getVarint(p, end, delta) || !getInt(p, end, 8, v))
+			return false;
+		frame += frameDelta;
+		cycle += delta;
+		chip8MovieCheckpoint e;
+		e.frame = (uint32_t)frame;
+		e.cycle = cycle;
+		e.hash = v;
+		c.push_back(e);
+	}
+	if (p != end)
+		return false;
+
+	rom = hash;
+	rngSeed = (uint32_t)seedValue;
+	ips = (unsigned int)speed;
+	every = (unsigned int)interval;
+	frameCount = (uint32_t)frames;
+	machine = (chip8Platform)platformId;
+	keys.swap(k);
+	checkpoints.swap(c);
+	lastKeys = keys.empty() ? 0 : keys.back().keys;
+	return true;
+}
+
+bool chip8Movie::start(chip8& c, const char* path) const {
+	uint64_t hash;
+	if (!hashRom(path, hash) || hash != rom)
+		return false;
+	c.initialize();
+	c.setPlatform(machine);
+	c.setClockSpeed(ips);
+	c.seed(rngSeed);
+	return c.loadGame(path);
+}
+
+void chip8Movie::replay(chip8& c, chip8MovieResult& out) const {
+	out.passed = 0;
+	out.failed = false;
+	out.badFrame = 0;
+	out.expected = out.actual = 0;
+	uint64_t first = c.getCycles();
+
+	// Each change becomes one event per key that differs
+	uint16_t held = c.getKeys();
+	for (const chip8MovieKeys& e : keys) {
+		uint16_t diff = held ^ e.keys;
+		for (unsigned char k = 0; k < 16; k++) {
+			if (!((diff >> k) & 0x1))
+				continue;
+			chip8InputEvent ev;
+			ev.cycle = e.cycle;
+			ev.arrived = 0;
+			ev.key = k;
+			ev.pressed = (e.keys >> k) & 0x1;
+			c.queueInput(ev);
+		}
+		held = e.keys;
+	}
+
+	for (const chip8MovieCheckpoint& p : checkpoints) {
+		// runFor only stops early once the ROM exited, and so did the
+		// recording then
+		while (c.getCycles() < p.cycle && !c.exitFlag) {
+			uint64_t left = p.cycle - c.getCycles();
+			c.runFor(left > 0x40000000 ? 0x40000000 : (unsigned int)left);
+		}
+		uint64_t hash = chip8Hash64(c.gfx, sizeof(c.gfx));
+		if (hash != p.hash) {
+			out.failed = true;
+			out.badFrame = p.frame;
+			out.expected = p.hash;
+			out.actual = hash;
+			break;
+		}
+		out.passed++;
+	}
+	out.cycles = c.getCycles() - first;
+}
+
+bool chip8Movie::hashRom(const char* path, uint64_t& out) {
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file)
+		return false;
+	std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	out = chip8Hash64(data.data(), data.size());
+	return true;
+}
@@ -0,0 +1,107 @@
+/*
+	Chip8 input movies
+
+	A movie is everything needed to run a session again instruction for
+	instruction: the ROM's hash, the platform, clock speed and CXNN seed it
+	ran with, and the keypad state each time it changed, keyed by the
+	instruction slot (chip8::getCycles) it changed at. Every N frames, and
+	on the last one, it also keeps a checkpoint: the cycle the frame ended
+	on and the hash of gfx there.
+
+	Replaying queues the key changes on their cycles (chip8::queueInput)
+	and runs from checkpoint to checkpoint as fast as the core goes,
+	comparing hashes. Cycles, not frames, carry the timing, so a replay
+	lands on the same instruction stream whatever the recording host's
+	frame pacing or fast forward was, in any execution mode.
+
+	File: a fixed little-endian header, then the key changes as (cycle
+	delta, state) and the checkpoints as (frame delta, cycle delta, hash),
+	deltas as LEB128 varints. A key change costs 3 to 5 bytes.
+*/
+#pragma once
+#include "Chip8Quirks.hpp"
+#include <cstdint>
+#include <vector>
+
+class chip8;
+
+static const uint32_t CHIP8_MOVIE_MAGIC = 0x564D3843;  // "C8MV"
+static const uint32_t CHIP8_MOVIE_VERSION = 1;
+
+struct chip8MovieKeys {
+	uint64_t cycle;
+	// Bit k set = key k pressed, from 'cycle' on
+	uint16_t keys;
+};
+
+struct chip8MovieCheckpoint {
+	// Frames recorded when it was taken, 1 = after the first
+	uint32_t frame;
+	uint64_t cycle;
+	// chip8Hash64 of all of gfx
+	uint64_t hash;
+};
+
+struct chip8MovieResult {
+	// Checkpoints that matched, and whether one did not
+	unsigned int passed;
+	bool failed;
+	// First mismatch when failed
+	uint32_t badFrame;
+	uint64_t expected, actual;
+	// Instruction slots replayed
+	uint64_t cycles;
+};
+
+class chip8Movie {
+public:
+	chip8Movie();
+
+	// Recording. c must be freshly loaded (no cycles run yet) with the
+	// platform, clock speed and seed it will run with. False otherwise.
+	bool begin(const chip8& c, uint64_t romHash, unsigned int checkpointEvery);
+	// Logs c's keypad if it changed. Call after setting keys (setKey,
+	// setKeys), before running on.
+	void input(const chip8& c);
+	// Call after each frame: counts it and takes every Nth checkpoint
+	void frame(const chip8& c);
+	// Closes the recording with a checkpoint on the last frame
+	void end(const chip8& c);
+
+	bool save(const char* path) const;
+	// False if the file is missing, malformed or of another version
+	bool load(const char* path);
+
+	// Replay. Sets c up as recorded and loads rom into it; false if rom
+	// cannot be loaded or is not the recorded ROM.
+	bool start(chip8& c, const char* rom) const;
+	// Runs c from start() to the last checkpoint at full speed. Stops at
+	// the first checkpoint that does not match.
+	void replay(chip8& c, chip8MovieResult& out) const;
+
+	// XXH64 of a ROM file, false if it cannot be read
+	static bool hashRom(const char* path, uint64_t& out);
+
+	uint64_t romHash() const { return rom; }
+	chip8Platform platform() const { return machine; }
+	unsigned int clockSpeed() const { return ips; }
+	uint32_t seed() const { return rngSeed; }
+	uint32_t frames() const { return frameCount; }
+	uint64_t cycles() const { return checkpoints.empty() ? 0 : checkpoints.back().cycle; }
+	const std::vector<chip8MovieKeys>& keyChanges() const { return keys; }
+	const std::vector<chip8MovieCheckpoint>& checkpointList() const { return checkpoints; }
+
+private:
+	uint64_t rom;
+	chip8Platform machine;
+	unsigned int ips;
+	uint32_t rngSeed;
+	unsigned int every;
+	uint32_t frameCount;
+	// Keypad as of the last entry in keys
+	uint16_t lastKeys;
+	std::vector<chip8MovieKeys> keys;
+	std::vector<chip8MovieCheckpoint> checkpoints;
+
+	void checkpoint(const chip8& c);
+};
@@ -0,0 +1,139 @@
+/*
+	Chip8 hot-spot profiler
+*/
+#include "Chip8Profile.hpp"
+#include "Chip8Dispatch.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+// Bounds on the call tree, calls past them stay in the caller's node
+static const unsigned int MAX_DEPTH = 64;
+static const size_t MAX_NODES = 1 << 16;
+
+// Indexed by chip8Handler
+static const char* const handlerNames[] = {
+	"0NNN", "00CN", "00E0", "00EE", "00FB", "00FC", "00FD", "00FE", "00FF",
+	"1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+	"8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7", "8XYE",
+	"9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX9E", "EXA1",
+	"F0NN", "FX07", "FX0A", "FX15", "FX18", "FX1E", "FX29", "FX30",
+	"FX33", "FX3A", "FX55", "FX65", "FX75", "FX85", "NULL",
+};
+
+static_assert(sizeof(handlerNames) / sizeof(handlerNames[0]) == chip8HandlerCount, "handler names out of sync with chip8Handler");
+static_assert(chip8HandlerCount <= chip8Profiler::HANDLERS, "profiler handler slots too few");
+
+const char* chip8Profiler::handlerName(unsigned int id) {
+	return id < sizeof(handlerNames) / sizeof(handlerNames[0]) ? handlerNames[id] : NULL;
+}
+
+chip8Profiler::chip8Profiler() {
+	clear();
+}
+
+void chip8Profiler::clear() {
+	memset(count, 0x0, sizeof(count));
+	memset(hostCycles, 0x0, sizeof(hostCycles));
+	memset(pcHits, 0x0, sizeof(pcHits));
+	nodes.clear();
+	node root{};
+	root.addr = 0x200;
+	nodes.push_back(root);
+	current = 0;
+	overflow = 0;
+}
+
+void chip8Profiler::call(unsigned short target) {
+	node& n = nodes[current];
+	for (size_t i = 0; i < n.children.size(); i++) {
+		if (nodes[n.children[i]].addr == target) {
+			current = n.children[i];
+			return;
+		}
+	}
+	if (n.depth >= MAX_DEPTH || nodes.size() >= MAX_NODES) {
+		overflow++;
+		return;
+	}
+	node child{};
+	child.parent = current;
+	child.addr = target;
+	child.depth = (unsigned short)(n.depth + 1);
+	unsigned int id = (unsigned int)nodes.size();
+	// n is invalidated by the push_back
+	nodes[current].children.push_back(id);
+	nodes.push_back(child);
+	current = id;
+}
+
+void chip8Profiler::ret() {
+	if (overflow > 0)
+		overflow--;
+	else
+		current = nodes[current].parent;
+}
+
+bool chip8Profiler::writeJson(const char* path) const {
+	std::ofstream out(path, std::ios::out | std::ios::trunc);
+	if (!out) return false;
+
+	uint64_t total = 0;
+	std::vector<unsigned int> handlers;
+	for (unsigned int i = 0; i < HANDLERS && handlerName(i); i++) {
+		total += count[i];
+		if (count[i] > 0)
+			handlers.push_back(i);
+	}
+	std::sort(handlers.begin(), handlers.end(), [this](unsigned int a, unsigned int b) {
+		return hostCycles[a] > hostCycles[b];
+	});
+	std::vector<unsigned short> pcs;
+	for (unsigned short pc = 0; pc < 4096; pc++)
+		if (pcHits[pc] > 0)
+			pcs.push_back(pc);
+	std::sort(pcs.begin(), pcs.end(), [this](unsigned short a, unsigned short b) {
+		return pcHits[a] > pcHits[b];
+	});
+
+	char buf[128];
+	out << "{\n  \"instructions\": " << total << ",\n  \"handlers\": [";
+	for (size_t i = 0; i < handlers.size(); i++) {
+		unsigned int h = handlers[i];
+		snprintf(buf, sizeof(buf), "%s\n    {\"name\": \"%s\", \"count\": %llu, \"cycles\": %llu}",
+			i ? "," : "", handlerName(h), (unsigned long long)count[h], (unsigned long long)hostCycles[h]);
+		out << buf;
+	}
+	out << "\n  ],\n  \"pc\": [";
+	for (size_t i = 0; i < pcs.size(); i++) {
+		snprintf(buf, sizeof(buf), "%s\n    {\"pc\": \"0x%03X\", \"hits\": %llu}",
+			i ? "," : "", pcs[i], (unsigned long long)pcHits[pcs[i]]);
+		out << buf;
+	}
+	out << "\n  ]\n}\n";
+	return true;
+}
+
+bool chip8Profiler::writeFolded(const char* path) const {
+	std::ofstream out(path, std::ios::out | std::ios::trunc);
+	if (!out) return false;
+
+	std::vector<unsigned int> chain;
+	char buf[16];
+	for (unsigned int id = 0; id < nodes.size(); id++) {
+		if (nodes[id].self == 0)
+			continue;
+		chain.clear();
+		for (unsigned int n = id; n != 0; n = nodes[n].parent)
+			chain.push_back(n);
+		std::string line = "rom";
+		for (size_t i = chain.size(); i > 0; i--) {
+			snprintf(buf, sizeof(buf), ";sub_%03X", nodes[chain[i - 1]].addr);
+			line += buf;
+		}
+		out << line << ' ' << nodes[id].self << '\n';
+	}
+	return true;
+}
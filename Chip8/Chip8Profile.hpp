@@ -0,0 +1,79 @@
+/*
+	Chip8 hot-spot profiler
+
+	Attached with chip8::setProfiler, it collects per-handler execution
+	counts and host cycles, a hit count per pc and a call tree built from
+	2NNN/00EE. Results export as JSON or as folded stacks for flamegraph
+	tools (weighted by instructions).
+
+	chip8 only feeds it when built with CHIP8_PROFILE defined; the
+	recompiler is bypassed while a profiler is attached.
+*/
+#pragma once
+#include <cstdint>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+class chip8Profiler {
+public:
+	// Slots for chip8Handler ids
+	static const unsigned int HANDLERS = 64;
+	// Mnemonic of a handler id, null past the last one
+	static const char* handlerName(unsigned int id);
+
+	chip8Profiler();
+	void clear();
+
+	// Called by chip8 after each instruction
+	void record(unsigned int handler, unsigned short pc, uint64_t cycles) {
+		count[handler]++;
+		hostCycles[handler] += cycles;
+		pcHits[pc & 0xFFF]++;
+		nodes[current].self++;
+	}
+	// 2NNN / 00EE
+	void call(unsigned short target);
+	void ret();
+
+	uint64_t handlerCount(unsigned int handler) const { return count[handler]; }
+	uint64_t handlerCycles(unsigned int handler) const { return hostCycles[handler]; }
+	uint64_t hits(unsigned short pc) const { return pcHits[pc & 0xFFF]; }
+
+	bool writeJson(const char* path) const;
+	// One "rom;sub_2A4;sub_31C <instructions>" line per call path
+	bool writeFolded(const char* path) const;
+
+	// Host timestamp in cycles (or nanoseconds where rdtsc is missing)
+	static uint64_t now() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+private:
+	// Call tree node, one per distinct call path
+	struct node {
+		unsigned int parent;
+		unsigned short addr;
+		unsigned short depth;
+		uint64_t self;
+		std::vector<unsigned int> children;
+	};
+
+	uint64_t count[HANDLERS];
+	uint64_t hostCycles[HANDLERS];
+	uint64_t pcHits[4096];
+	std::vector<node> nodes;
+	unsigned int current;
+	// Calls not entered in the tree (too deep or too many paths)
+	unsigned int overflow;
+};
@@ -0,0 +1,44 @@
+/*
+	Chip8 quirk profiles
+*/
+#include "Chip8Quirks.hpp"
+#include <cctype>
+#include <cstring>
+
+static const chip8QuirkInfo platforms[] = {
+	chip8DescribeQuirks<chip8QuirksDefault>("default"),
+	chip8DescribeQuirks<chip8QuirksChip8>("chip8"),
+	chip8DescribeQuirks<chip8QuirksChip48>("chip48"),
+	chip8DescribeQuirks<chip8QuirksSchip11>("schip11"),
+	chip8DescribeQuirks<chip8QuirksXoChip>("xochip"),
+};
+static_assert(sizeof(platforms) / sizeof(platforms[0]) == chip8PlatformCount, "platforms out of sync with chip8Platform");
+
+const chip8QuirkInfo& chip8PlatformQuirks(chip8Platform p) {
+	return platforms[p < chip8PlatformCount ? p : platformDefault];
+}
+
+bool chip8PlatformFromName(const char* name, chip8Platform& p) {
+	for (unsigned int i = 0; i < chip8PlatformCount; i++) {
+		if (!strcmp(name, platforms[i].name)) {
+			p = (chip8Platform)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+chip8Platform chip8PlatformForFile(const char* path) {
+	const char* dot = strrchr(path, '.');
+	if (!dot || strlen(dot) != 4)
+		return platformDefault;
+	// Lower case, terminator included
+	char ext[4];
+	for (int i = 0; i < 4; i++)
+		ext[i] = (char)tolower((unsigned char)dot[i + 1]);
+	if (!strcmp(ext, "sc8"))
+		return platformSchip11;
+	if (!strcmp(ext, "xo8"))
+		return platformXoChip;
+	return platformDefault;
+}
@@ -0,0 +1,98 @@
+/*
+	Chip8 quirk profiles
+
+	Platforms disagree on a few opcodes. Each profile is a policy struct of
+	compile-time constants; chip8 instantiates its interpreter once per
+	profile (see chip8::setPlatform), so the handlers test constants that
+	fold away instead of a runtime setting.
+*/
+#pragma once
+
+enum chip8Platform : unsigned char {
+	// What this core has always done, also used for .ch8/.c8 files
+	platformDefault,
+	// COSMAC VIP
+	platformChip8,
+	// HP-48
+	platformChip48,
+	platformSchip11,
+	platformXoChip,
+	chip8PlatformCount
+};
+
+// FX55/FX65: what happens to I after the transfer
+enum chip8IndexQuirk : unsigned char {
+	indexKeep,
+	// I += X (CHIP-48)
+	indexAddX,
+	// I += X + 1 (COSMAC VIP)
+	indexAddX1
+};
+
+// 8XY6/8XYE shift VY into VX / FX55,FX65 / BNNN adds VX (X = top nibble of
+// NNN) instead of V0 / DXYN clips at the screen edges instead of wrapping /
+// F002 loads the audio pattern and FX3A sets its pitch instead of F0NN
+struct chip8QuirksDefault {
+	static constexpr bool shiftVY = false;
+	static constexpr chip8IndexQuirk index = indexKeep;
+	static constexpr bool jumpVX = false;
+	static constexpr bool clipSprites = false;
+	static constexpr bool xoAudio = false;
+};
+
+struct chip8QuirksChip8 {
+	static constexpr bool shiftVY = true;
+	static constexpr chip8IndexQuirk index = indexAddX1;
+	static constexpr bool jumpVX = false;
+	static constexpr bool clipSprites = true;
+	static constexpr bool xoAudio = false;
+};
+
+struct chip8QuirksChip48 {
+	static constexpr bool shiftVY = false;
+	static constexpr chip8IndexQuirk index = indexAddX;
+	static constexpr bool jumpVX = true;
+	static constexpr bool clipSprites = true;
+	static constexpr bool xoAudio = false;
+};
+
+struct chip8QuirksSchip11 {
+	static constexpr bool shiftVY = false;
+	static constexpr chip8IndexQuirk index = indexKeep;
+	static constexpr bool jumpVX = true;
+	static constexpr bool clipSprites = true;
+	static constexpr bool xoAudio = false;
+};
+
+struct chip8QuirksXoChip {
+	static constexpr bool shiftVY = true;
+	static constexpr chip8IndexQuirk index = indexAddX1;
+	static constexpr bool jumpVX = false;
+	static constexpr bool clipSprites = false;
+	static constexpr bool xoAudio = true;
+};
+
+// A profile's constants as data, for code that is not instantiated per
+// profile (the recompiler, tools)
+struct chip8QuirkInfo {
+	const char* name;
+	bool shiftVY;
+	chip8IndexQuirk index;
+	bool jumpVX;
+	bool clipSprites;
+	bool xoAudio;
+};
+
+template <class Q>
+constexpr chip8QuirkInfo chip8DescribeQuirks(const char* name) {
+	return { name, Q::shiftVY, Q::index, Q::jumpVX, Q::clipSprites, Q::xoAudio };
+}
+
+// Profile of a platform; out of range ids get the default one
+const chip8QuirkInfo& chip8PlatformQuirks(chip8Platform p);
+// Platform from its name ("default", "chip8", "chip48", "schip11",
+// "xochip"), false if unknown
+bool chip8PlatformFromName(const char* name, chip8Platform& p);
+// Platform implied by a ROM file name: .sc8 is SCHIP 1.1, .xo8 XO-CHIP,
+// anything else the default
+chip8Platform chip8PlatformForFile(const char* path);
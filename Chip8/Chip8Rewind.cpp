@@ -0,0 +1,174 @@
+/*
+	Chip8 rewind buffer
+*/
+#include "Chip8Rewind.hpp"
+#include <cstring>
+
+// Delta tokens: [u16 unchanged bytes][u16 literal bytes][literal XOR bytes]
+static const size_t STATE_SIZE = sizeof(chip8State);
+
+static void put16(uint8_t* p, uint16_t v) {
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static uint16_t get16(const uint8_t* p) {
+	return p[0] | (p[1] << 8);
+}
+
+chip8Rewind::chip8Rewind(size_t capacity, unsigned int interval) {
+	// Room for at least two keyframes
+	ring.resize(capacity < 2 * STATE_SIZE ? 2 * STATE_SIZE : capacity);
+	keyInterval = interval > 0 ? interval : 1;
+	// Worst case of an encoded delta, before falling back to a keyframe
+	delta.resize(STATE_SIZE * 2 + 4);
+	clear();
+}
+
+void chip8Rewind::clear() {
+	entries.clear();
+	head = 0;
+	used = 0;
+	sinceKey = 0;
+	memset(&keyState, 0x0, STATE_SIZE);
+}
+
+void chip8Rewind::capture(const chip8& c) {
+	c.saveState(scratch);
+	if (!entries.empty() && sinceKey < keyInterval) {
+		size_t n = encode(scratch);
+		if (n < STATE_SIZE && store(delta.data(), n, false)) {
+			sinceKey++;
+			return;
+		}
+	}
+	store((const uint8_t*)&scratch, STATE_SIZE, true);
+	memcpy(&keyState, &scratch, STATE_SIZE);
+	sinceKey = 1;
+}
+
+bool chip8Rewind::rewind(chip8& c, unsigned int frames) {
+	if (frames == 0 || frames > entries.size())
+		return false;
+	for (unsigned int i = 1; i < frames; i++) {
+		used -= entries.back().size;
+		entries.pop_back();
+	}
+	entry e = entries.back();
+	entries.pop_back();
+	used -= e.size;
+	head = e.offset;
+
+	// Base of the restored delta is the newest keyframe before it
+	if (!e.key) {
+		size_t k = entries.size();
+		while (!entries[k - 1].key)
+			k--;
+		decode(entries[k - 1], keyState);
+	}
+	decode(e, scratch);
+	c.loadState(scratch);
+
+	// Following captures continue from the newest remaining keyframe
+	sinceKey = 0;
+	for (size_t k = entries.size(); k > 0; k--) {
+		sinceKey++;
+		if (entries[k - 1].key) {
+			decode(entries[k - 1], keyState);
+			return true;
+		}
+	}
+	return true;
+}
+
+size_t chip8Rewind::encode(const chip8State& s) {
+	const uint8_t* a = (const uint8_t*)&s;
+	const uint8_t* k = (const uint8_t*)&keyState;
+	uint8_t* out = delta.data();
+	size_t len = 0;
+	size_t pos = 0;
+	while (pos < STATE_SIZE) {
+		size_t start = pos;
+		// Skip unchanged bytes a word at a time
+		while (pos + 8 <= STATE_SIZE) {
+			uint64_t x, y;
+			memcpy(&x, a + pos, 8);
+			memcpy(&y, k + pos, 8);
+			if (x != y)
+				break;
+			pos += 8;
+		}
+		while (pos < STATE_SIZE && a[pos] == k[pos])
+			pos++;
+		if (pos == STATE_SIZE)
+			break;
+		size_t lit = pos;
+		// A literal run ends at 4 unchanged bytes, which pay for a new token
+		while (pos < STATE_SIZE) {
+			if (a[pos] == k[pos] && pos + 4 <= STATE_SIZE && !memcmp(a + pos, k + pos, 4))
+				break;
+			pos++;
+		}
+		if (len + 4 + (pos - lit) > delta.size())
+			return STATE_SIZE;
+		put16(out + len, (uint16_t)(lit - start));
+		put16(out + len + 2, (uint16_t)(pos - lit));
+		len += 4;
+		for (size_t i = lit; i < pos; i++)
+			out[len++] = a[i] ^ k[i];
+	}
+	return len;
+}
+
+void chip8Rewind::decode(const entry& e, chip8State& out) const {
+	const uint8_t* in = &ring[e.offset];
+	if (e.key) {
+		memcpy(&out, in, STATE_SIZE);
+		return;
+	}
+	memcpy(&out, &keyState, STATE_SIZE);
+	uint8_t* o = (uint8_t*)&out;
+	size_t pos = 0;
+	size_t i = 0;
+	while (i < e.size) {
+		pos += get16(in + i);
+		uint16_t n = get16(in + i + 2);
+		i += 4;
+		for (uint16_t j = 0; j < n; j++)
+			o[pos++] ^= in[i++];
+	}
+}
+
+bool chip8Rewind::store(const uint8_t* data, size_t size, bool key) {
+	if (head + size > ring.size()) {
+		// Entries left past the old head are the oldest ones
+		while (!entries.empty() && entries.front().offset >= head)
+			dropOldest();
+		head = 0;
+	}
+	while (!entries.empty()) {
+		const entry& f = entries.front();
+		if (f.offset >= head + size || f.offset + f.size <= head)
+			break;
+		dropOldest();
+	}
+	// A delta whose keyframe was just evicted cannot be decoded
+	if (!key && entries.empty())
+		return false;
+	memcpy(&ring[head], data, size);
+	entry e = { head, (uint32_t)size, key };
+	entries.push_back(e);
+	head += size;
+	used += size;
+	return true;
+}
+
+void chip8Rewind::dropOldest() {
+	used -= entries.front().size;
+	entries.pop_front();
+	// Deltas are useless without their keyframe
+	while (!entries.empty() && !entries.front().key) {
+		used -= entries.front().size;
+		entries.pop_front();
+	}
+}
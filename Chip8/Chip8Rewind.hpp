@@ -0,0 +1,56 @@
+/*
+	Chip8 rewind buffer
+
+	Keeps one chip8State per captured frame in a fixed-size byte ring.
+	Every keyInterval-th capture is stored whole (keyframe); the others are
+	stored as the XOR against the latest keyframe, with runs of unchanged
+	bytes skipped. The oldest keyframe and its deltas are dropped together
+	when the ring fills up.
+*/
+#pragma once
+#include "Chip8.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class chip8Rewind {
+public:
+	chip8Rewind(size_t capacity = 4 << 20, unsigned int keyInterval = 60);
+	// Records the current state of c
+	void capture(const chip8& c);
+	// Restores the state captured 'frames' captures ago and drops it along
+	// with everything newer. Returns false if the history is shorter.
+	bool rewind(chip8& c, unsigned int frames = 1);
+	void clear();
+
+	// Captures currently held
+	size_t frames() const { return entries.size(); }
+	size_t bytesUsed() const { return used; }
+	size_t capacity() const { return ring.size(); }
+
+private:
+	struct entry {
+		size_t offset;
+		uint32_t size;
+		bool key;
+	};
+
+	std::vector<uint8_t> ring;
+	std::deque<entry> entries;
+	size_t head;
+	size_t used;
+	unsigned int keyInterval;
+	// Captures since the newest keyframe
+	unsigned int sinceKey;
+	// Newest keyframe, the base of the following deltas
+	chip8State keyState;
+	chip8State scratch;
+	std::vector<uint8_t> delta;
+
+	size_t encode(const chip8State& s);
+	void decode(const entry& e, chip8State& out) const;
+	// False if a delta would lose its keyframe to make room
+	bool store(const uint8_t* data, size_t size, bool key);
+	void dropOldest();
+};
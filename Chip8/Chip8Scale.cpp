@@ -0,0 +1,280 @@
+/*
+	Chip8 framebuffer upscaler
+*/
+#include "Chip8Scale.hpp"
+#include "Chip8.hpp"
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CHIP8_SCALE_SSE2
+#endif
+
+// Pixel masks of one packed byte, MSB first, in byte order
+static const uint64_t BIT_LANES = 0x0102040810204080ull;
+static const uint64_t BYTE_REPEAT = 0x0101010101010101ull;
+
+////////////// Kernels ////////////////////////////
+
+// One 64-pixel word to 64 intensities, 0 or 255
+static void unpackWord(uint64_t w, uint8_t* out) {
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	const __m256i lanes = _mm256_set1_epi64x((long long)BIT_LANES);
+	for (; i < 64; i += 32) {
+		unsigned int s = 56 - i;
+		__m256i v = _mm256_set_epi64x(
+			(long long)(((w >> (s - 24)) & 0xFF) * BYTE_REPEAT), (long long)(((w >> (s - 16)) & 0xFF) * BYTE_REPEAT),
+			(long long)(((w >> (s - 8)) & 0xFF) * BYTE_REPEAT), (long long)(((w >> s) & 0xFF) * BYTE_REPEAT));
+		v = _mm256_cmpeq_epi8(_mm256_and_si256(v, lanes), lanes);
+		_mm256_storeu_si256((__m256i*)(out + i), v);
+	}
+#elif defined(CHIP8_SCALE_SSE2)
+	const __m128i lanes = _mm_set1_epi64x((long long)BIT_LANES);
+	for (; i < 64; i += 16) {
+		unsigned int s = 56 - i;
+		__m128i v = _mm_set_epi64x(
+			(long long)(((w >> (s - 8)) & 0xFF) * BYTE_REPEAT), (long long)(((w >> s) & 0xFF) * BYTE_REPEAT));
+		v = _mm_cmpeq_epi8(_mm_and_si128(v, lanes), lanes);
+		_mm_storeu_si128((__m128i*)(out + i), v);
+	}
+#endif
+	for (; i < 64; i++)
+		out[i] = (w >> (63 - i)) & 0x1 ? 0xFF : 0x00;
+}
+
+// glow = max(lit, glow * keep / 256), n a multiple of 64
+static void decayGlow(uint8_t* glow, const uint8_t* lit, unsigned int keep, unsigned int n) {
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	const __m256i k = _mm256_set1_epi16((short)keep);
+	const __m256i zero = _mm256_setzero_si256();
+	for (; i + 32 <= n; i += 32) {
+		__m256i g = _mm256_loadu_si256((const __m256i*)(glow + i));
+		__m256i lo = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(g, zero), k), 8);
+		__m256i hi = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(g, zero), k), 8);
+		g = _mm256_max_epu8(_mm256_packus_epi16(lo, hi), _mm256_loadu_si256((const __m256i*)(lit + i)));
+		_mm256_storeu_si256((__m256i*)(glow + i), g);
+	}
+#elif defined(CHIP8_SCALE_SSE2)
+	const __m128i k = _mm_set1_epi16((short)keep);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i g = _mm_loadu_si128((const __m128i*)(glow + i));
+		__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(g, zero), k), 8);
+		__m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(g, zero), k), 8);
+		g = _mm_max_epu8(_mm_packus_epi16(lo, hi), _mm_loadu_si128((const __m128i*)(lit + i)));
+		_mm_storeu_si128((__m128i*)(glow + i), g);
+	}
+#endif
+	for (; i < n; i++) {
+		uint8_t d = (uint8_t)((glow[i] * keep) >> 8);
+		glow[i] = lit[i] > d ? lit[i] : d;
+	}
+}
+
+// out[2i] = a[i], out[2i + 1] = b[i], n a multiple of 16
+static void interleave(const uint8_t* a, const uint8_t* b, uint8_t* out, unsigned int n) {
+	unsigned int i = 0;
+#if defined(CHIP8_SCALE_SSE2)
+	for (; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+		_mm_storeu_si128((__m128i*)(out + 2 * i), _mm_unpacklo_epi8(x, y));
+		_mm_storeu_si128((__m128i*)(out + 2 * i + 16), _mm_unpackhi_epi8(x, y));
+	}
+#endif
+	for (; i < n; i++) {
+		out[2 * i] = a[i];
+		out[2 * i + 1] = b[i];
+	}
+}
+
+// n copies of c
+static inline void fill(uint32_t* p, uint32_t c, unsigned int n) {
+	unsigned int i = 0;
+#if defined(__AVX2__)
+	if (n >= 8) {
+		const __m256i v = _mm256_set1_epi32((int)c);
+		for (; i + 8 <= n; i += 8)
+			_mm256_storeu_si256((__m256i*)(p + i), v);
+	}
+#endif
+#if defined(CHIP8_SCALE_SSE2)
+	if (n - i >= 4) {
+		const __m128i v = _mm_set1_epi32((int)c);
+		for (; i + 4 <= n; i += 4)
+			_mm_storeu_si128((__m128i*)(p + i), v);
+	}
+#endif
+	for (; i < n; i++)
+		p[i] = c;
+}
+
+// Scale2x of one screen row, 'wpr' words per row. p is the row, a and d
+// the rows above and below (p itself at the edges). Works on 64 pixels at
+// a time: l and r hold each pixel's left and right neighbour.
+static void scale2xRow(const uint64_t* a, const uint64_t* p, const uint64_t* d, unsigned int wpr, uint64_t* e0, uint64_t* e1, uint64_t* e2, uint64_t* e3) {
+	const uint64_t msb = 0x8000000000000000ull;
+	for (unsigned int i = 0; i < wpr; i++) {
+		uint64_t l = (p[i] >> 1) | (i > 0 ? p[i - 1] << 63 : p[i] & msb);
+		uint64_t r = (p[i] << 1) | (i + 1 < wpr ? p[i + 1] >> 63 : p[i] & 0x1);
+		uint64_t up = a[i], down = d[i];
+		// Corner takes the neighbour when the two sides meeting there agree
+		// and the opposite sides do not
+		uint64_t m0 = ~(l ^ up) & (l ^ down) & (up ^ r);
+		uint64_t m1 = ~(up ^ r) & (up ^ l) & (r ^ down);
+		uint64_t m2 = ~(down ^ l) & (down ^ r) & (l ^ up);
+		uint64_t m3 = ~(r ^ down) & (r ^ up) & (down ^ l);
+		e0[i] = (m0 & up) | (~m0 & p[i]);
+		e1[i] = (m1 & r) | (~m1 & p[i]);
+		e2[i] = (m2 & l) | (~m2 & p[i]);
+		e3[i] = (m3 & down) | (~m3 & p[i]);
+	}
+}
+
+////////////// Scaler ////////////////////////////
+
+chip8Scaler::chip8Scaler() {
+	filter = filterNearest;
+	scale = 8;
+	decay = 160;
+	off = chip8Rgba(0x00, 0x00, 0x00);
+	on = chip8Rgba(0xFF, 0xFF, 0xFF);
+	memset(levels, 0x0, sizeof(levels));
+	memset(glow, 0x0, sizeof(glow));
+	lastFullscreen = false;
+	buildRamp();
+}
+
+void chip8Scaler::buildRamp() {
+	for (unsigned int i = 0; i < 256; i++) {
+		uint32_t c = 0;
+		for (unsigned int shift = 0; shift < 32; shift += 8) {
+			uint32_t from = (off >> shift) & 0xFF, to = (on >> shift) & 0xFF;
+			c |= ((from * (255 - i) + to * i + 127) / 255) << shift;
+		}
+		ramp[i] = c;
+	}
+	stale = true;
+}
+
+void chip8Scaler::setPalette(uint32_t offColor, uint32_t onColor) {
+	off = offColor;
+	on = onColor;
+	buildRamp();
+}
+
+void chip8Scaler::setFilter(chip8Filter f) {
+	filter = f < chip8FilterCount ? f : filterNearest;
+	memset(glow, 0x0, sizeof(glow));
+	stale = true;
+}
+
+void chip8Scaler::setScale(unsigned int s) {
+	scale = s < 1 ? 1 : s > 64 ? 64 : s;
+	stale = true;
+}
+
+void chip8Scaler::setDecay(unsigned int keep) {
+	decay = keep > 255 ? 255 : keep;
+}
+
+void chip8Scaler::outputSize(bool fullscreen, unsigned int& width, unsigned int& height) const {
+	width = (fullscreen ? 128 : 64) * scale;
+	height = (fullscreen ? 64 : 32) * scale;
+}
+
+void chip8Scaler::expandLine(const uint8_t* src, unsigned int n, unsigned int even, unsigned int odd, uint32_t* out) const {
+	if (even == 1 && odd == 1) {
+		for (unsigned int i = 0; i < n; i++)
+			out[i] = ramp[src[i]];
+		return;
+	}
+	for (unsigned int i = 0; i < n; i += 2) {
+		fill(out, ramp[src[i]], even);
+		out += even;
+		fill(out, ramp[src[i + 1]], odd);
+		out += odd;
+	}
+}
+
+void chip8Scaler::emit(const uint8_t* grid, unsigned int width, unsigned int first, unsigned int last, unsigned int even, unsigned int odd, uint32_t* out, size_t pitch) const {
+	for (unsigned int g = first; g < last; g++) {
+		unsigned int height = g & 1 ? odd : even;
+		if (height == 0)
+			continue;
+		size_t y = (g >> 1) * (even + odd) + (g & 1) * even;
+		uint32_t* line = (uint32_t*)((uint8_t*)out + y * pitch);
+		expandLine(grid + g * width, width, even, odd, line);
+		size_t bytes = (size_t)(width / 2) * (even + odd) * sizeof(uint32_t);
+		for (unsigned int k = 1; k < height; k++)
+			memcpy((uint8_t*)line + k * pitch, line, bytes);
+	}
+}
+
+void chip8Scaler::render(const chip8& c, uint32_t* out, size_t pitch, uint64_t rows) {
+	render(c.gfx, c.fullscreen, out, pitch, rows);
+}
+
+void chip8Scaler::render(const uint64_t* gfx, bool fullscreen, uint32_t* out, size_t pitch, uint64_t rows) {
+	unsigned int wpr = fullscreen ? 2 : 1;
+	unsigned int w = 64 * wpr, h = 32 * wpr;
+	uint64_t all = fullscreen ? ~0ull : 0xFFFFFFFFull;
+	if (stale || fullscreen != lastFullscreen) {
+		rows = all;
+		if (fullscreen != lastFullscreen)
+			memset(glow, 0x0, sizeof(glow));
+	}
+	stale = false;
+	lastFullscreen = fullscreen;
+
+	switch (filter) {
+	case filterNearest:
+		rows &= all;
+		for (unsigned int r = 0; r < h; r++) {
+			if (!(rows >> r & 0x1))
+				continue;
+			for (unsigned int i = 0; i < wpr; i++)
+				unpackWord(gfx[r * wpr + i], levels + r * w + 64 * i);
+			emit(levels, w, r, r + 1, scale, scale, out, pitch);
+		}
+		break;
+
+	case filterScale2x: {
+		// A row's corners depend on the rows around it
+		rows = (rows | rows << 1 | rows >> 1) & all;
+		uint64_t e[4][2];
+		uint8_t bytes[4][128];
+		for (unsigned int r = 0; r < h; r++) {
+			if (!(rows >> r & 0x1))
+				continue;
+			const uint64_t* p = gfx + r * wpr;
+			scale2xRow(r > 0 ? p - wpr : p, p, r + 1 < h ? p + wpr : p, wpr, e[0], e[1], e[2], e[3]);
+			for (unsigned int k = 0; k < 4; k++) {
+				for (unsigned int i = 0; i < wpr; i++)
+					unpackWord(e[k][i], bytes[k] + 64 * i);
+			}
+			interleave(bytes[0], bytes[1], levels + (2 * r) * (2 * w), w);
+			interleave(bytes[2], bytes[3], levels + (2 * r + 1) * (2 * w), w);
+			emit(levels, 2 * w, 2 * r, 2 * r + 2, (scale + 1) / 2, scale / 2, out, pitch);
+		}
+		break;
+	}
+
+	case filterPhosphor:
+		for (unsigned int r = 0; r < h; r++) {
+			for (unsigned int i = 0; i < wpr; i++)
+				unpackWord(gfx[r * wpr + i], levels + r * w + 64 * i);
+		}
+		decayGlow(glow, levels, decay, w * h);
+		emit(glow, w, 0, h, scale, scale, out, pitch);
+		break;
+
+	default:
+		break;
+	}
+}
@@ -0,0 +1,79 @@
+/*
+	Chip8 framebuffer upscaler
+
+	Turns the 1bpp chip8::gfx image into scaled RGBA for front ends that
+	draw on the CPU or upload a finished texture. The image is first
+	reduced to one intensity byte per (sub)pixel by the filter, then every
+	byte is widened to 'scale' pixels through a 256-entry palette ramp and
+	each finished line is copied down. Bit unpacking, the phosphor decay
+	and the pixel fills use SSE2, or AVX2 when built with it; Scale2x works
+	on whole 64-pixel words. All buffers are members or the caller's, so
+	rendering does not allocate.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+class chip8;
+
+enum chip8Filter : unsigned char {
+	// Square blocks
+	filterNearest,
+	// Scale2x/EPX corner rounding, then blocks of scale / 2
+	filterScale2x,
+	// Lit pixels fade out over a few frames like a CRT phosphor
+	filterPhosphor,
+	chip8FilterCount
+};
+
+// Color whose bytes in memory are r, g, b, a (little-endian hosts)
+inline uint32_t chip8Rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 0xFF) {
+	return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+}
+
+class chip8Scaler {
+public:
+	chip8Scaler();
+	// Colors of unlit and lit pixels, see chip8Rgba
+	void setPalette(uint32_t off, uint32_t on);
+	void setFilter(chip8Filter f);
+	chip8Filter getFilter() const { return filter; }
+	// Output pixels per screen pixel of the current mode (1 to 64)
+	void setScale(unsigned int s);
+	unsigned int getScale() const { return scale; }
+	// Phosphor: share of a pixel's brightness kept per rendered frame, /256
+	void setDecay(unsigned int keep);
+	// Size of the output for a mode, in pixels
+	void outputSize(bool fullscreen, unsigned int& width, unsigned int& height) const;
+
+	// Writes the image to out, 'pitch' bytes between lines (at least
+	// width * 4). Bit r of 'rows' marks screen row r as changed (see
+	// chip8Damage); the others are left as the previous call wrote them.
+	// Ignored by the phosphor filter, and on the first call after a mode
+	// or setting change.
+	void render(const uint64_t* gfx, bool fullscreen, uint32_t* out, size_t pitch, uint64_t rows = ~0ull);
+	void render(const chip8& c, uint32_t* out, size_t pitch, uint64_t rows = ~0ull);
+
+private:
+	chip8Filter filter;
+	unsigned int scale;
+	unsigned int decay;
+	uint32_t off, on;
+	// Color of each intensity, off at 0 to on at 255
+	uint32_t ramp[256];
+	// Intensities of the filtered image, up to 256x128 for Scale2x
+	uint8_t levels[256 * 128];
+	// Phosphor brightness per screen pixel
+	uint8_t glow[128 * 64];
+	// Mode of the previous render, forces a full one when it changes
+	bool lastFullscreen;
+	// Set by the setters; the next render redraws everything
+	bool stale;
+
+	void buildRamp();
+	// Widens one line of intensities to out; even and odd entries take
+	// 'even' and 'odd' pixels
+	void expandLine(const uint8_t* src, unsigned int n, unsigned int even, unsigned int odd, uint32_t* out) const;
+	// Expands rows [first, last) of a grid 'width' intensities wide into out
+	void emit(const uint8_t* grid, unsigned int width, unsigned int first, unsigned int last, unsigned int even, unsigned int odd, uint32_t* out, size_t pitch) const;
+};
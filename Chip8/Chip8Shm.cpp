@@ -0,0 +1,231 @@
+/*
+	Chip8 shared-memory transport
+*/
+#include "Chip8Shm.hpp"
+#include "Chip8.hpp"
+#include "Chip8Clock.hpp"
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Processes only agree on the atomics if they need no lock
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "shared-memory atomics must be lock-free");
+
+static const uint32_t INPUT_MASK = CHIP8_SHM_INPUTS - 1;
+
+chip8Shm::chip8Shm() {
+	region = nullptr;
+	owner = false;
+	lastInput = 0;
+	heldKeys = 0;
+	name[0] = '\0';
+#ifdef _WIN32
+	mapping = nullptr;
+#endif
+}
+
+chip8Shm::~chip8Shm() {
+	close();
+}
+
+// Maps the region 'name', creating it if 'create' is set. Fills the
+// platform name used for it.
+#ifdef _WIN32
+static chip8ShmRegion* mapRegion(const char* id, bool create, char* name, size_t size, void*& mapping) {
+	snprintf(name, size, "Local\\chip8-%s", id);
+	HANDLE h = create
+		? CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(chip8ShmRegion), name)
+		: OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if (!h)
+		return nullptr;
+	void* p = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(chip8ShmRegion));
+	if (!p) {
+		CloseHandle(h);
+		return nullptr;
+	}
+	mapping = h;
+	return (chip8ShmRegion*)p;
+}
+#else
+static chip8ShmRegion* mapRegion(const char* id, bool create, char* name, size_t size) {
+	snprintf(name, size, "/chip8-%s", id);
+	// Owner only: viewers run as the same user, and anyone who can write
+	// the region can drive the keypad
+	int fd = shm_open(name, create ? O_RDWR | O_CREAT : O_RDWR, 0600);
+	if (fd < 0)
+		return nullptr;
+	struct stat st;
+	if (create ? ftruncate(fd, sizeof(chip8ShmRegion)) != 0 : fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(chip8ShmRegion)) {
+		::close(fd);
+		return nullptr;
+	}
+	void* p = mmap(nullptr, sizeof(chip8ShmRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	return p != MAP_FAILED ? (chip8ShmRegion*)p : nullptr;
+}
+#endif
+
+bool chip8Shm::create(const char* id) {
+	close();
+#ifdef _WIN32
+	region = mapRegion(id, true, name, sizeof(name), mapping);
+#else
+	region = mapRegion(id, true, name, sizeof(name));
+#endif
+	if (!region)
+		return false;
+	owner = true;
+	lastInput = 0;
+	heldKeys = 0;
+	// Viewers check the magic, written last
+	memset((void*)region, 0x0, sizeof(chip8ShmRegion));
+	region->version = CHIP8_SHM_VERSION;
+	region->size = sizeof(chip8ShmRegion);
+	region->closed.store(0, std::memory_order_relaxed);
+	region->sequence.store(0, std::memory_order_relaxed);
+	region->inputHead.store(0, std::memory_order_relaxed);
+	region->inputTail.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	region->magic = CHIP8_SHM_MAGIC;
+	return true;
+}
+
+bool chip8Shm::open(const char* id) {
+	close();
+#ifdef _WIN32
+	region = mapRegion(id, false, name, sizeof(name), mapping);
+#else
+	region = mapRegion(id, false, name, sizeof(name));
+#endif
+	if (!region)
+		return false;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (region->magic != CHIP8_SHM_MAGIC || region->version != CHIP8_SHM_VERSION || region->size != sizeof(chip8ShmRegion)) {
+		close();
+		return false;
+	}
+	owner = false;
+	return true;
+}
+
+void chip8Shm::close() {
+	if (!region)
+		return;
+	if (owner)
+		region->closed.store(1, std::memory_order_release);
+#ifdef _WIN32
+	UnmapViewOfFile(region);
+	CloseHandle((HANDLE)mapping);
+	mapping = nullptr;
+#else
+	munmap((void*)region, sizeof(chip8ShmRegion));
+	if (owner)
+		shm_unlink(name);
+#endif
+	region = nullptr;
+	owner = false;
+}
+
+void chip8Shm::publish(chip8& c) {
+	chip8Damage d;
+	c.takeDamage(d);
+	uint64_t seq = region->sequence.load(std::memory_order_relaxed);
+	region->sequence.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	region->published = chip8Now();
+	region->rows = d.rows;
+	region->inputSent = lastInput;
+	region->fullscreen = c.fullscreen;
+	// beepFlag latches, each frame reports it once
+	region->beep = c.beepFlag;
+	c.beepFlag = false;
+	region->exited = c.exitFlag;
+	memcpy(region->gfx, c.gfx, sizeof(region->gfx));
+	region->sequence.store(seq + 2, std::memory_order_release);
+}
+
+unsigned int chip8Shm::pollInput(chip8& c) {
+	uint32_t tail = region->inputTail.load(std::memory_order_relaxed);
+	uint32_t head = region->inputHead.load(std::memory_order_acquire);
+	uint32_t n = head - tail;
+	if (n == 0) {
+		// A tap released within the last frame ends here
+		c.setKeys(heldKeys);
+		return 0;
+	}
+	// A viewer writing garbage cannot make us read past the ring
+	if (n > CHIP8_SHM_INPUTS)
+		tail = head - CHIP8_SHM_INPUTS;
+	uint16_t keys = 0;
+	for (uint32_t i = tail; i != head; i++)
+		keys |= region->input[i & INPUT_MASK].keys;
+	// Keys tapped and released between two frames still count for this
+	// one; the newest state holds from the next poll on
+	c.setKeys(keys);
+	heldKeys = region->input[(head - 1) & INPUT_MASK].keys;
+	lastInput = region->input[(head - 1) & INPUT_MASK].sent;
+	region->inputTail.store(head, std::memory_order_release);
+	return n;
+}
+
+uint64_t chip8Shm::beginRead() const {
+	for (;;) {
+		uint64_t seq = region->sequence.load(std::memory_order_acquire);
+		if (!(seq & 0x1))
+			return seq;
+		std::this_thread::yield();
+	}
+}
+
+bool chip8Shm::endRead(uint64_t seq) const {
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return region->sequence.load(std::memory_order_relaxed) == seq;
+}
+
+bool chip8Shm::readFrame(chip8ShmFrame& out) const {
+	uint64_t seq;
+	do {
+		seq = beginRead();
+		if (seq == 0)
+			return false;
+		out.published = region->published;
+		out.rows = region->rows;
+		out.inputSent = region->inputSent;
+		out.fullscreen = region->fullscreen != 0;
+		out.beep = region->beep != 0;
+		out.exited = region->exited != 0;
+		memcpy(out.gfx, region->gfx, sizeof(out.gfx));
+	} while (!endRead(seq));
+	out.number = seq / 2;
+	return true;
+}
+
+uint64_t chip8Shm::frameCount() const {
+	return region->sequence.load(std::memory_order_acquire) / 2;
+}
+
+bool chip8Shm::sendKeys(uint16_t keys) {
+	uint32_t head = region->inputHead.load(std::memory_order_relaxed);
+	uint32_t tail = region->inputTail.load(std::memory_order_acquire);
+	if (head - tail >= CHIP8_SHM_INPUTS)
+		return false;
+	chip8ShmInput& in = region->input[head & INPUT_MASK];
+	memset(&in, 0x0, sizeof(in));
+	in.keys = keys;
+	in.sent = chip8Now();
+	region->inputHead.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+bool chip8Shm::closed() const {
+	return region->closed.load(std::memory_order_acquire) != 0;
+}
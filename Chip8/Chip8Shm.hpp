@@ -0,0 +1,134 @@
+/*
+	Chip8 shared-memory transport
+
+	Lets a headless emulator process feed front ends in other processes.
+	The emulator creates a named shared-memory region and publishes every
+	frame into it; any number of viewers map the same region and read the
+	frame in place. Nothing is copied per viewer and there is no socket.
+
+	The frame is guarded by a sequence counter (a seqlock): it is odd while
+	the emulator writes and bumped to the next even value when done, so a
+	reader that saw the same even value before and after reading has a
+	consistent frame. The emulator never waits for readers.
+
+	Key input goes the other way through a single-producer/single-consumer
+	ring: one viewer, the one holding the keyboard, pushes keypad states;
+	the emulator drains them before each frame.
+
+	POSIX shared memory (shm_open) or a Windows named file mapping.
+*/
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+class chip8;
+
+static const uint32_t CHIP8_SHM_MAGIC = 0x4D533843;    // "C8SM"
+static const uint32_t CHIP8_SHM_VERSION = 1;
+// Input ring entries, a power of two
+static const uint32_t CHIP8_SHM_INPUTS = 256;
+
+struct chip8ShmInput {
+	// Bit k set = key k pressed
+	uint16_t keys;
+	uint16_t reserved[3];
+	// chip8Now() of the viewer when sent
+	uint64_t sent;
+};
+
+// Layout of the mapped region. Only fixed-size fields and lock-free
+// atomics, so every process sees the same bytes.
+struct chip8ShmRegion {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	// Set by the emulator on shutdown
+	std::atomic<uint32_t> closed;
+
+	// Frame, written under the sequence counter
+	alignas(64) std::atomic<uint64_t> sequence;
+	// chip8Now() when published
+	uint64_t published;
+	// Damage since the previous frame, see chip8Damage
+	uint64_t rows;
+	// Latest chip8ShmInput::sent applied before this frame, 0 if none
+	uint64_t inputSent;
+	uint8_t fullscreen;
+	uint8_t beep;
+	uint8_t exited;
+	uint8_t reserved[5];
+	uint64_t gfx[128];
+
+	// Input ring, head written by the viewer and tail by the emulator
+	alignas(64) std::atomic<uint32_t> inputHead;
+	alignas(64) std::atomic<uint32_t> inputTail;
+	chip8ShmInput input[CHIP8_SHM_INPUTS];
+};
+
+// Copy of the frame part of the region
+struct chip8ShmFrame {
+	// 1 for the first frame published
+	uint64_t number;
+	uint64_t published;
+	uint64_t rows;
+	uint64_t inputSent;
+	bool fullscreen;
+	bool beep;
+	bool exited;
+	uint64_t gfx[128];
+};
+
+class chip8Shm {
+public:
+	chip8Shm();
+	~chip8Shm();
+	chip8Shm(const chip8Shm&) = delete;
+	chip8Shm& operator=(const chip8Shm&) = delete;
+
+	// Emulator side: creates (or takes over) the region 'name'
+	bool create(const char* name);
+	// Viewer side: maps an existing region, false if there is none or its
+	// layout differs
+	bool open(const char* name);
+	// Unmaps; the creator also marks the region closed and removes the name
+	void close();
+	bool isOpen() const { return region != nullptr; }
+	// Region in place, for reading gfx without a copy between
+	// beginRead() and endRead()
+	const chip8ShmRegion* data() const { return region; }
+
+	// Emulator: publishes the screen of c with its damage (see
+	// chip8::takeDamage)
+	void publish(chip8& c);
+	// Emulator: applies the queued key states to c. A key pressed in any
+	// of them is held for the next frame, so taps shorter than a frame are
+	// not lost; from the poll after, the newest state applies. Returns the
+	// number drained.
+	unsigned int pollInput(chip8& c);
+
+	// Viewer: start of a read, the sequence value to hand to endRead().
+	// Spins while a write is in progress.
+	uint64_t beginRead() const;
+	// Viewer: true if nothing was written since beginRead() returned 'seq'
+	bool endRead(uint64_t seq) const;
+	// Viewer: consistent copy of the newest frame, false before the first
+	bool readFrame(chip8ShmFrame& out) const;
+	// Viewer: frames published so far, without reading one
+	uint64_t frameCount() const;
+	// Viewer holding the keyboard: queues a keypad state, false if the
+	// ring is full
+	bool sendKeys(uint16_t keys);
+	// Viewer: the emulator has shut down
+	bool closed() const;
+
+private:
+	chip8ShmRegion* region;
+	bool owner;
+	// Emulator: inputSent and keys of the latest drained input
+	uint64_t lastInput;
+	uint16_t heldKeys;
+	char name[128];
+#ifdef _WIN32
+	void* mapping;
+#endif
+};
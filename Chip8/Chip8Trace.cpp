@@ -0,0 +1,123 @@
+/*
+	Chip8 instruction trace
+*/
+#include "Chip8Trace.hpp"
+#include <chrono>
+#include <cstdio>
+
+chip8TraceRing::chip8TraceRing(size_t capacity) {
+	size_t size = 1;
+	while (size < capacity)
+		size <<= 1;
+	records.resize(size);
+	mask = size - 1;
+	head.store(0, std::memory_order_relaxed);
+	tail.store(0, std::memory_order_relaxed);
+	lost.store(0, std::memory_order_relaxed);
+	tailCache = 0;
+}
+
+bool chip8TraceRing::push(const chip8TraceRecord& r) {
+	uint64_t h = head.load(std::memory_order_relaxed);
+	if (h - tailCache > mask) {
+		tailCache = tail.load(std::memory_order_acquire);
+		if (h - tailCache > mask) {
+			lost.store(lost.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return false;
+		}
+	}
+	records[h & mask] = r;
+	head.store(h + 1, std::memory_order_release);
+	return true;
+}
+
+size_t chip8TraceRing::pop(chip8TraceRecord* out, size_t max) {
+	uint64_t t = tail.load(std::memory_order_relaxed);
+	uint64_t h = head.load(std::memory_order_acquire);
+	size_t n = (size_t)(h - t);
+	if (n > max)
+		n = max;
+	for (size_t i = 0; i < n; i++)
+		out[i] = records[(t + i) & mask];
+	tail.store(t + n, std::memory_order_release);
+	return n;
+}
+
+void chip8TraceRing::format(const chip8TraceRecord& r, char* out, size_t size) {
+	int len = snprintf(out, size, "%10llu %03X %04X I=%03X",
+		(unsigned long long)r.cycle, r.pc, r.opcode, r.I);
+	for (int x = 0; x < 16 && len > 0 && (size_t)len < size; x++) {
+		if (r.changed & (1 << x))
+			len += snprintf(out + len, size - len, " V%X=%02X", x, r.V[x]);
+	}
+}
+
+chip8TraceWriter::chip8TraceWriter(chip8TraceRing& ring) : ring(ring) {
+	text = false;
+	running = false;
+}
+
+chip8TraceWriter::~chip8TraceWriter() {
+	stop();
+}
+
+bool chip8TraceWriter::start(const char* path, bool asText) {
+	stop();
+	file.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+	text = asText;
+	running = true;
+	worker = std::thread(&chip8TraceWriter::run, this);
+	return true;
+}
+
+void chip8TraceWriter::stop() {
+	if (!worker.joinable())
+		return;
+	running = false;
+	worker.join();
+	file.close();
+}
+
+void chip8TraceWriter::run() {
+	chip8TraceRecord buffer[1024];
+	for (;;) {
+		// Read the flag first so records pushed before stop() are drained
+		bool more = running;
+		size_t n = ring.pop(buffer, 1024);
+		if (n > 0) {
+			write(buffer, n);
+			continue;
+		}
+		if (!more)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	file.flush();
+}
+
+void chip8TraceWriter::write(const chip8TraceRecord* r, size_t n) {
+	if (!text) {
+		file.write((const char*)r, sizeof(chip8TraceRecord) * n);
+		return;
+	}
+	char line[160];
+	for (size_t i = 0; i < n; i++) {
+		chip8TraceRing::format(r[i], line, sizeof(line));
+		file << line << '\n';
+	}
+}
+
+bool chip8TraceDump(const char* path, std::ostream& out) {
+	std::ifstream in(path, std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+	chip8TraceRecord r;
+	char line[160];
+	while (in.read((char*)&r, sizeof(r))) {
+		chip8TraceRing::format(r, line, sizeof(line));
+		out << line << '\n';
+	}
+	return true;
+}
@@ -0,0 +1,85 @@
+/*
+	Chip8 instruction trace
+
+	Fixed-size single-producer/single-consumer ring of binary records.
+	The emulation thread pushes one record per instruction while debugMode
+	is on; a chip8TraceWriter thread (or any other single consumer) drains
+	it. When the ring is full records are dropped and counted, the
+	emulator never waits on the consumer.
+
+	chip8 only records when built with CHIP8_TRACE defined.
+*/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// 32 bytes, written to trace files as is
+struct chip8TraceRecord {
+	// chip8::getCycles() when it ran, as movies and input events count
+	uint64_t cycle;
+	uint16_t pc;
+	uint16_t opcode;
+	// I after the instruction
+	uint16_t I;
+	// Bit x set = VX changed
+	uint16_t changed;
+	// V0..VF after the instruction
+	uint8_t V[16];
+};
+
+class chip8TraceRing {
+public:
+	// Capacity is rounded up to a power of two
+	chip8TraceRing(size_t capacity = 1 << 16);
+	// Producer side; false if the ring is full and the record was dropped
+	bool push(const chip8TraceRecord& r);
+	// Consumer side; returns the number of records copied to out
+	size_t pop(chip8TraceRecord* out, size_t max);
+	// Records dropped so far
+	uint64_t dropped() const { return lost.load(std::memory_order_relaxed); }
+
+	// One text line per record: cycle, pc, opcode, I, changed registers
+	static void format(const chip8TraceRecord& r, char* out, size_t size);
+
+private:
+	std::vector<chip8TraceRecord> records;
+	size_t mask;
+	// Producer and consumer indices on separate cache lines
+	char pad0[64];
+	std::atomic<uint64_t> head;
+	// Producer's last view of tail, refreshed only when the ring looks full
+	uint64_t tailCache;
+	std::atomic<uint64_t> lost;
+	char pad1[64];
+	std::atomic<uint64_t> tail;
+	char pad2[64];
+};
+
+// Background consumer, writes the ring to a file as it fills
+class chip8TraceWriter {
+public:
+	chip8TraceWriter(chip8TraceRing& ring);
+	~chip8TraceWriter();
+	// Binary records, or text lines when text is set
+	bool start(const char* path, bool text);
+	// Drains what is left and closes the file
+	void stop();
+
+private:
+	chip8TraceRing& ring;
+	std::ofstream file;
+	bool text;
+	std::atomic<bool> running;
+	std::thread worker;
+
+	void run();
+	void write(const chip8TraceRecord* r, size_t n);
+};
+
+// Offline decoder: binary trace file to text lines
+bool chip8TraceDump(const char* path, std::ostream& out);
@@ -0,0 +1,408 @@
+/*
+	Chip8 ahead-of-time translator
+
+	Chip8Aot rom out.cpp [name]
+
+	Walks the control flow of a ROM from 0x200, following jumps, calls,
+	returns to the caller and both ways of every skip, and writes a C++
+	file defining 'const chip8AotProgram chip8Aot_<name>' (see
+	Chip8Aot.hpp). Every reachable instruction becomes a label followed by
+	straight-line code: register and flow opcodes are inlined, the others
+	call back into the interpreter for that one instruction. Indirect
+	targets (00EE, EX9E/EXA1 results) go through a switch on pc. The cycle
+	budget is checked once per straight-line block, not per instruction.
+*/
+#include "Chip8Dispatch.hpp"
+#include <cctype>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static const unsigned short ORIGIN = 0x200;
+
+struct romImage {
+	std::vector<unsigned char> bytes;
+
+	// Both bytes of the instruction at addr are part of the image
+	bool holds(unsigned int addr) const {
+		return addr >= ORIGIN && addr + 1 < ORIGIN + bytes.size();
+	}
+	unsigned short opcode(unsigned int addr) const {
+		return bytes[addr - ORIGIN] << 8 | bytes[addr + 1 - ORIGIN];
+	}
+};
+
+enum opKind {
+	// Inlined
+	inlined,
+	// Interpreted in place, execution continues at pc + 2
+	callNext,
+	// Interpreted in place, execution continues wherever pc ends up
+	callDispatch,
+	// Left to the interpreter: compiled code returns before it
+	exitHere,
+};
+
+static opKind kindOf(chip8Handler h) {
+	switch (h) {
+	case op00EE: case op1NNN: case op2NNN:
+	case op3XNN: case op4XNN: case op5XY0: case op9XY0:
+	case op6XNN: case op7XNN: case opANNN:
+	case op8XY0: case op8XY1: case op8XY2: case op8XY3: case op8XY4:
+	case op8XY5: case op8XY6: case op8XY7: case op8XYE:
+		return inlined;
+	case op00CN: case op00E0: case op00FB: case op00FC: case op00FE: case op00FF:
+	case opCXNN: case opDXYN: case opF0NN: case opFX1E: case opFX29: case opFX30:
+	case opFX33: case opFX55: case opFX65: case opFX75: case opFX85:
+		return callNext;
+	case opEX9E: case opEXA1:
+		return callDispatch;
+	default:
+		// 0NNN, 00FD, BNNN, timers, FX0A, unknown opcodes
+		return exitHere;
+	}
+}
+
+// Marks every instruction reachable from 0x200
+static std::vector<bool> walk(const romImage& rom) {
+	std::vector<bool> reached(4096, false);
+	std::vector<unsigned int> work(1, ORIGIN);
+	while (!work.empty()) {
+		unsigned int a = work.back();
+		work.pop_back();
+		if (!rom.holds(a) || reached[a])
+			continue;
+		reached[a] = true;
+		unsigned short op = rom.opcode(a);
+		chip8Handler h = chip8Classify(op);
+		switch (h) {
+		case op1NNN:
+			work.push_back(op & 0x0FFF);
+			break;
+		case op2NNN:
+			// The return lands on a + 2
+			work.push_back(op & 0x0FFF);
+			work.push_back(a + 2);
+			break;
+		case op00EE: case op00FD: case opBNNN:
+			break;
+		case op3XNN: case op4XNN: case op5XY0: case op9XY0: case opEX9E: case opEXA1:
+			work.push_back(a + 2);
+			work.push_back(a + 4);
+			break;
+		default:
+			work.push_back(a + 2);
+			break;
+		}
+	}
+	return reached;
+}
+
+// Straight-line runs longer than this are split, so a small cycle budget
+// still gets to run compiled code
+static const unsigned int MAX_BLOCK = 32;
+
+// Instructions after which compiled code never simply moves on to pc + 2
+static bool endsBlock(chip8Handler h) {
+	switch (h) {
+	case op00EE: case op1NNN: case op2NNN:
+	case op3XNN: case op4XNN: case op5XY0: case op9XY0:
+	case opEX9E: case opEXA1:
+	// These may overwrite translated code
+	case opFX33: case opFX55:
+		return true;
+	default:
+		return kindOf(h) == exitHere;
+	}
+}
+
+// Splits the translated code into blocks: runs of instructions that follow
+// each other with no way in or out but the first and last one. Cycles are
+// counted once per block; entering a block part way through (a jump or a
+// return into it) checks and counts the rest of it.
+struct blockMap {
+	const romImage& rom;
+	const std::vector<bool>& reached;
+	std::vector<bool> leader;
+
+	blockMap(const romImage& r, const std::vector<bool>& reach) : rom(r), reached(reach), leader(4096, false) {
+		for (unsigned int a = 0; a < 4096; a++) {
+			if (!translated(a) || (a >= 2 && continues(a - 2)))
+				continue;
+			unsigned int n = 0;
+			for (unsigned int cur = a;; cur += 2) {
+				if (n++ % MAX_BLOCK == 0)
+					leader[cur] = true;
+				if (!continues(cur))
+					break;
+			}
+		}
+	}
+	bool translated(unsigned int a) const {
+		return a < 4096 && reached[a] && kindOf(chip8Classify(rom.opcode(a))) != exitHere;
+	}
+	// Execution always goes on to a + 2 inside the same chain
+	bool continues(unsigned int a) const {
+		return translated(a) && !endsBlock(chip8Classify(rom.opcode(a))) && translated(a + 2);
+	}
+	// Instructions from a to the end of its block
+	unsigned int remaining(unsigned int a) const {
+		unsigned int n = 1;
+		while (continues(a) && !leader[a + 2]) {
+			a += 2;
+			n++;
+		}
+		return n;
+	}
+	// Reached from a - 2 without a budget check
+	bool inside(unsigned int a) const {
+		return a >= 2 && continues(a - 2) && !leader[a];
+	}
+};
+
+struct emitter {
+	FILE* out;
+	const romImage& rom;
+	const std::vector<bool>& reached;
+	const blockMap& blocks;
+
+	// Continue at 'target': a goto if it was translated, else return to the caller
+	std::string jump(unsigned int target) const {
+		char s[64];
+		if (target < 4096 && reached[target])
+			snprintf(s, sizeof(s), "goto E_%03X;", target);
+		else
+			snprintf(s, sizeof(s), "{ *x.pc = 0x%03X; goto out; }", target & 0xFFFF);
+		return s;
+	}
+
+	void line(const char* fmt, ...) const;
+	void instruction(unsigned int a, unsigned int next) const;
+};
+
+void emitter::line(const char* fmt, ...) const {
+	va_list args;
+	va_start(args, fmt);
+	fputc('\t', out);
+	vfprintf(out, fmt, args);
+	fputc('\n', out);
+	va_end(args);
+}
+
+// 'next' is the label emitted after this one, 0 if none. E_xxx checks and
+// counts the cycles left in the block, L_xxx is the fall-through entry.
+void emitter::instruction(unsigned int a, unsigned int next) const {
+	unsigned short op = rom.opcode(a);
+	chip8Handler h = chip8Classify(op);
+	unsigned int x = (op & 0x0F00) >> 8;
+	unsigned int y = (op & 0x00F0) >> 4;
+	unsigned int nn = op & 0x00FF;
+	unsigned int nnn = op & 0x0FFF;
+	opKind kind = kindOf(h);
+
+	fprintf(out, "E_%03X: // %04X\n", a, op);
+	if (kind == exitHere) {
+		line("*x.pc = 0x%03X;", a);
+		line("goto out;");
+		return;
+	}
+	unsigned int n = blocks.remaining(a);
+	line("if (cycles - done < %u) { *x.pc = 0x%03X; goto out; }", n, a);
+	line("done += %u;", n);
+	if (blocks.inside(a))
+		fprintf(out, "L_%03X:\n", a);
+	// Stack overflow and underflow are left to the interpreter. Both end
+	// their block, so only this instruction is uncounted.
+	if (h == op2NNN)
+		line("if (sp >= 16) { *x.pc = 0x%03X; done--; goto out; }", a);
+	else if (h == op00EE)
+		line("if (sp == 0) { *x.pc = 0x%03X; done--; goto out; }", a);
+	line("op = 0x%04X;", op);
+
+	bool fallsThrough = true;
+	switch (h) {
+	case op00EE:
+		line("--sp;");
+		line("*x.pc = stack[sp] + 2;");
+		line("goto dispatch;");
+		return;
+	case op1NNN:
+		line("%s", jump(nnn).c_str());
+		return;
+	case op2NNN:
+		line("stack[sp] = 0x%03X;", a);
+		line("++sp;");
+		line("%s", jump(nnn).c_str());
+		return;
+	case op3XNN: line("if (v[0x%X] == 0x%02X) %s", x, nn, jump(a + 4).c_str()); break;
+	case op4XNN: line("if (v[0x%X] != 0x%02X) %s", x, nn, jump(a + 4).c_str()); break;
+	case op5XY0: line("if (v[0x%X] == v[0x%X]) %s", x, y, jump(a + 4).c_str()); break;
+	case op9XY0: line("if (v[0x%X] != v[0x%X]) %s", x, y, jump(a + 4).c_str()); break;
+	case op6XNN: line("v[0x%X] = 0x%02X;", x, nn); break;
+	case op7XNN: line("v[0x%X] += 0x%02X;", x, nn); break;
+	case opANNN: line("I = 0x%03X;", nnn); break;
+	case op8XY0: line("v[0x%X] = v[0x%X];", x, y); break;
+	case op8XY1: line("v[0x%X] |= v[0x%X];", x, y); break;
+	case op8XY2: line("v[0x%X] &= v[0x%X];", x, y); break;
+	case op8XY3: line("v[0x%X] ^= v[0x%X];", x, y); break;
+	// VF is written first, as the interpreter does, for X or Y = F
+	case op8XY4:
+		line("v[0xF] = v[0x%X] > 0xFF - v[0x%X];", y, x);
+		line("v[0x%X] += v[0x%X];", x, y);
+		break;
+	case op8XY5:
+		line("v[0xF] = v[0x%X] >= v[0x%X];", x, y);
+		line("v[0x%X] -= v[0x%X];", x, y);
+		break;
+	case op8XY6:
+		line("v[0xF] = v[0x%X] & 0x1;", x);
+		line("v[0x%X] >>= 1;", x);
+		break;
+	case op8XY7:
+		line("v[0xF] = v[0x%X] >= v[0x%X];", y, x);
+		line("v[0x%X] = v[0x%X] - v[0x%X];", x, y, x);
+		break;
+	case op8XYE:
+		line("v[0xF] = (v[0x%X] & 0x80) >> 7;", x);
+		line("v[0x%X] <<= 1;", x);
+		break;
+	default:
+		line("*x.pc = 0x%03X;", a);
+		line("x.spill(v, I, sp);");
+		line("chip8AotExec(x);");
+		line("x.fill(v, I, sp);");
+		if (h == opFX33 || h == opFX55)
+			line("if (*x.modified) goto out;");
+		if (kind == callDispatch) {
+			line("goto dispatch;");
+			fallsThrough = false;
+		}
+		break;
+	}
+	if (!fallsThrough)
+		return;
+	if (blocks.inside(a + 2))
+		line("goto L_%03X;", a + 2);
+	else if (next != a + 2)
+		line("%s", jump(a + 2).c_str());
+}
+
+static std::string identifier(const char* path, const char* name) {
+	std::string s;
+	if (name)
+		s = name;
+	else {
+		s = path;
+		size_t slash = s.find_last_of("/\\");
+		if (slash != std::string::npos)
+			s = s.substr(slash + 1);
+		size_t dot = s.find_last_of('.');
+		if (dot != std::string::npos)
+			s = s.substr(0, dot);
+	}
+	for (size_t i = 0; i < s.size(); i++)
+		if (!isalnum((unsigned char)s[i]))
+			s[i] = '_';
+	return s;
+}
+
+static int usage() {
+	fprintf(stderr, "usage: Chip8Aot rom out.cpp [name]\n");
+	return 2;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3 || argc > 4)
+		return usage();
+
+	romImage rom;
+	FILE* in = fopen(argv[1], "rb");
+	if (!in) {
+		fprintf(stderr, "cannot open %s\n", argv[1]);
+		return 1;
+	}
+	int ch;
+	while ((ch = fgetc(in)) != EOF)
+		rom.bytes.push_back((unsigned char)ch);
+	fclose(in);
+	// Same limit as chip8::loadGame
+	if (rom.bytes.empty() || rom.bytes.size() > 0xFFF - ORIGIN) {
+		fprintf(stderr, "%s: bad ROM size\n", argv[1]);
+		return 1;
+	}
+
+	std::vector<bool> reached = walk(rom);
+	std::vector<unsigned int> labels;
+	unsigned char code[512] = {};
+	// Only declared when used, so the output compiles without warnings
+	bool usesStack = false, usesDispatch = false;
+	for (unsigned int a = 0; a < 4096; a++) {
+		if (!reached[a])
+			continue;
+		chip8Handler h = chip8Classify(rom.opcode(a));
+		usesStack = usesStack || h == op2NNN || h == op00EE;
+		usesDispatch = usesDispatch || h == op00EE || kindOf(h) == callDispatch;
+		labels.push_back(a);
+		code[a >> 3] |= 1 << (a & 7);
+		code[(a + 1) >> 3] |= 1 << ((a + 1) & 7);
+	}
+
+	std::string id = identifier(argv[1], argc > 3 ? argv[3] : NULL);
+	FILE* out = fopen(argv[2], "w");
+	if (!out) {
+		fprintf(stderr, "cannot write %s\n", argv[2]);
+		return 1;
+	}
+	std::string rom0 = argv[1];
+	size_t slash = rom0.find_last_of("/\\");
+	if (slash != std::string::npos)
+		rom0 = rom0.substr(slash + 1);
+	fprintf(out, "// Generated by Chip8Aot from %s, do not edit.\n", rom0.c_str());
+	fprintf(out, "// %u instructions translated.\n", (unsigned int)labels.size());
+	fprintf(out, "#include \"Chip8Aot.hpp\"\n\n");
+
+	fprintf(out, "static const unsigned char image[%u] = {", (unsigned int)rom.bytes.size());
+	for (size_t i = 0; i < rom.bytes.size(); i++)
+		fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n\t", rom.bytes[i]);
+	fprintf(out, "\n};\n\n");
+	fprintf(out, "static const unsigned char code[512] = {");
+	for (size_t i = 0; i < sizeof(code); i++)
+		fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n\t", code[i]);
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static unsigned int run(chip8AotContext& x, unsigned int cycles) {\n");
+	fprintf(out, "\tunsigned char v[16];\n");
+	fprintf(out, "\tunsigned short I, sp;\n");
+	if (usesStack)
+		fprintf(out, "\tunsigned short* stack = x.stack;\n");
+	fprintf(out, "\tunsigned short op = *x.opcode;\n");
+	fprintf(out, "\tunsigned int done = 0;\n");
+	fprintf(out, "\tx.fill(v, I, sp);\n");
+	if (usesDispatch)
+		fprintf(out, "dispatch:\n");
+	fprintf(out, "\tswitch (*x.pc) {\n");
+	for (size_t i = 0; i < labels.size(); i++)
+		fprintf(out, "\tcase 0x%03X: goto E_%03X;\n", labels[i], labels[i]);
+	fprintf(out, "\tdefault: goto out;\n");
+	fprintf(out, "\t}\n");
+
+	blockMap blocks(rom, reached);
+	emitter e = { out, rom, reached, blocks };
+	for (size_t i = 0; i < labels.size(); i++)
+		e.instruction(labels[i], i + 1 < labels.size() ? labels[i + 1] : 0);
+
+	fprintf(out, "out:\n");
+	fprintf(out, "\tx.spill(v, I, sp);\n");
+	fprintf(out, "\t*x.opcode = op;\n");
+	fprintf(out, "\treturn done;\n");
+	fprintf(out, "}\n\n");
+	fprintf(out, "extern const chip8AotProgram chip8Aot_%s;\n", id.c_str());
+	fprintf(out, "const chip8AotProgram chip8Aot_%s = { \"%s\", image, %u, code, run };\n",
+		id.c_str(), id.c_str(), (unsigned int)rom.bytes.size());
+	if (fclose(out) != 0)
+		return 1;
+	printf("%s: %u instructions -> %s (chip8Aot_%s)\n", argv[1], (unsigned int)labels.size(), argv[2], id.c_str());
+	return 0;
+}
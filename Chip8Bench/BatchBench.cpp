@@ -0,0 +1,106 @@
+/*
+	Batch interpreter benchmark: N lanes of chip8Batch against N chip8 objects
+*/
+#include "Bench.hpp"
+#include "Chip8.hpp"
+#include "Chip8Batch.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Counted loop with a key dependent branch, so lanes diverge and meet again
+static const unsigned char benchRom[] = {
+	0x60, 0x00,             // 200: V0 = 0
+	0x61, 0x01,             // 202: V1 = 1
+	0x70, 0x01,             // 204: V0 += 1
+	0x82, 0x04,             // 206: V2 = V0
+	0x82, 0x14,             // 208: V2 += V1
+	0x83, 0x25,             // 20A: V3 -= V2
+	0x84, 0x26,             // 20C: V4 = V2 >> 1
+	0x85, 0x3E,             // 20E: V5 = V3 << 1
+	0xA3, 0x00,             // 210: I = 300
+	0xF0, 0x1E,             // 212: I += V0
+	0x66, 0x05,             // 214: V6 = 5
+	0xE6, 0xA1,             // 216: skip if key V6 up
+	0x87, 0x54,             // 218: V7 += V5
+	0xC8, 0x0F,             // 21A: V8 = rand & F
+	0x30, 0x00,             // 21C: skip if V0 == 0
+	0x12, 0x04,             // 21E: jump 204
+	0x12, 0x00,             // 220: jump 200
+};
+
+static double seconds(std::chrono::steady_clock::time_point t0) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// argv[0] is the "batch" command
+int batchBench(int argc, char** argv) {
+	unsigned int lanes = argc > 1 ? atoi(argv[1]) : 1024;
+	unsigned int cycles = argc > 2 ? atoi(argv[2]) : 20000;
+	const char* rom = argc > 3 ? argv[3] : "BatchBench.ch8";
+	if (argc <= 3) {
+		FILE* f = fopen(rom, "wb");
+		if (!f) return 1;
+		fwrite(benchRom, 1, sizeof(benchRom), f);
+		fclose(f);
+	}
+
+	chip8Batch batch(lanes);
+	if (!batch.loadGame(rom)) {
+		fprintf(stderr, "cannot load %s\n", rom);
+		return 1;
+	}
+	std::vector<chip8*> single(lanes);
+	for (unsigned int l = 0; l < lanes; l++) {
+		// Every fourth lane holds key 5
+		uint16_t keys = (l % 4 == 0) ? 0x20 : 0x0;
+		batch.setKeys(l, keys);
+		single[l] = new chip8();
+		// Lanes start seeded l + 1
+		single[l]->seed(l + 1);
+		single[l]->loadGame(rom);
+		single[l]->setKeys(keys);
+	}
+
+	auto t0 = std::chrono::steady_clock::now();
+	batch.emulateCycles(cycles);
+	double batchTime = seconds(t0);
+
+	t0 = std::chrono::steady_clock::now();
+	for (unsigned int l = 0; l < lanes; l++)
+		single[l]->runFor(cycles);
+	double singleTime = seconds(t0);
+
+	double total = (double)lanes * cycles;
+	printf("kernels        %s\n", chip8Batch::kernels());
+	printf("lanes          %u\n", lanes);
+	printf("cycles/lane    %u\n", cycles);
+	printf("lockstep       %.1f%%\n", 100.0 * batch.lockstepSteps / (batch.lockstepSteps + batch.divergentSteps));
+	printf("batch          %.2f MIPS\n", total / batchTime / 1e6);
+	printf("separate       %.2f MIPS\n", total / singleTime / 1e6);
+	printf("speedup        %.2fx\n", singleTime / batchTime);
+
+	// Each lane must end where its separate chip8 did
+	unsigned int mismatches = 0;
+	chip8 lane;
+	chip8State a, b;
+	for (unsigned int l = 0; l < lanes; l++) {
+		batch.exportLane(l, lane);
+		lane.saveState(a);
+		single[l]->saveState(b);
+		if (memcmp(&a, &b, sizeof(chip8State)) != 0) {
+			if (mismatches++ < 8)
+				fprintf(stderr, "lane %u differs from its chip8 (pc %03X vs %03X)\n", l, a.pc, b.pc);
+		}
+	}
+	if (mismatches)
+		fprintf(stderr, "%u of %u lanes differ\n", mismatches, lanes);
+
+	for (unsigned int l = 0; l < lanes; l++)
+		delete single[l];
+	if (argc <= 3)
+		remove(rom);
+	return mismatches ? 1 : 0;
+}
@@ -0,0 +1,283 @@
+/*
+	Chip8 core benchmark suite
+
+	Chip8Bench [-r reps] [-f frames] [-s ips] [-m interp|jit|all] [rom ...]
+	Chip8Bench batch [lanes] [cycles] [rom]
+	Chip8Bench replay [-r reps] [-m interp|jit|all] movie rom
+	Chip8Bench diff [-c cycles] [-k slice] [-m jit|aot|all] [-o] [rom ...]
+
+	Runs built-in synthetic ROMs, one per opcode family, then any ROM files
+	given on the command line, 'frames' frames per repetition at 'ips'
+	instructions per emulated second. One warm-up run precedes the timed
+	repetitions. Output is one line per ROM and mode:
+
+	name  mode  MIPS(mean)  MIPS(min)  MIPS(max)  stddev%  ns/ins  frames/s
+
+	followed by '#' lines with how often each fused opcode sequence ran.
+*/
+#include "Bench.hpp"
+#include "Chip8.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// 8XYN arithmetic and logic
+static const unsigned char arithRom[] = {
+	0x60, 0x01,             // 200: V0 = 1
+	0x61, 0x03,             // 202: V1 = 3
+	0x80, 0x14,             // 204: V0 += V1
+	0x81, 0x05,             // 206: V1 -= V0
+	0x82, 0x06,             // 208: V2 = V0 >> 1
+	0x83, 0x0E,             // 20A: V3 = V0 << 1
+	0x80, 0x11,             // 20C: V0 |= V1
+	0x81, 0x22,             // 20E: V1 &= V2
+	0x82, 0x33,             // 210: V2 ^= V3
+	0x83, 0x07,             // 212: V3 = V0 - V3
+	0x84, 0x10,             // 214: V4 = V1
+	0x74, 0x01,             // 216: V4 += 1
+	0x12, 0x04,             // 218: jump 204
+};
+
+// DXYN, 8x15 sprites overlapping each other, cleared every 64 passes
+static const unsigned char drawRom[] = {
+	0x00, 0xE0,             // 200: clear
+	0x60, 0x00,             // 202: V0 = 0
+	0x61, 0x00,             // 204: V1 = 0
+	0xA2, 0x18,             // 206: I = 218
+	0xD0, 0x1F,             // 208: draw 8x15 at V0, V1
+	0x70, 0x05,             // 20A: V0 += 5
+	0x71, 0x03,             // 20C: V1 += 3
+	0xD0, 0x1F,             // 20E: draw 8x15 at V0, V1
+	0x70, 0x07,             // 210: V0 += 7
+	0x30, 0x00,             // 212: skip if V0 == 0
+	0x12, 0x08,             // 214: jump 208
+	0x12, 0x00,             // 216: jump 200
+	0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF,
+	0x18, 0x3C, 0x7E, 0xFF, 0x7E, 0x3C, 0x18,
+};
+
+// SCHIP extended mode: 16x16 sprites and scrolling in every direction
+static const unsigned char scrollRom[] = {
+	0x00, 0xFF,             // 200: extended mode
+	0xA2, 0x18,             // 202: I = 218
+	0x60, 0x00,             // 204: V0 = 0
+	0x61, 0x00,             // 206: V1 = 0
+	0xD0, 0x10,             // 208: draw 16x16 at V0, V1
+	0x00, 0xC2,             // 20A: scroll down 2
+	0x00, 0xFB,             // 20C: scroll right 4
+	0xD0, 0x10,             // 20E: draw 16x16 at V0, V1
+	0x00, 0xFC,             // 210: scroll left 4
+	0x70, 0x11,             // 212: V0 += 11
+	0x71, 0x07,             // 214: V1 += 7
+	0x12, 0x08,             // 216: jump 208
+	0xFF, 0xFF, 0xC0, 0x03, 0xCF, 0xF3, 0xC8, 0x13,
+	0xCB, 0xD3, 0xCA, 0x53, 0xCA, 0x53, 0xCB, 0xD3,
+	0xC8, 0x13, 0xCF, 0xF3, 0xC0, 0x03, 0xFF, 0xFF,
+	0x0F, 0xF0, 0x30, 0x0C, 0xC0, 0x03, 0xFF, 0xFF,
+};
+
+// FX55/FX65/FX33 over a 2 KB window
+static const unsigned char memoryRom[] = {
+	0x6E, 0x00,             // 200: VE = 0
+	0x6C, 0x10,             // 202: VC = 10
+	0xA3, 0x00,             // 204: I = 300
+	0xFB, 0x65,             // 206: load V0..VB
+	0xFB, 0x55,             // 208: store V0..VB
+	0xF0, 0x33,             // 20A: BCD of V0
+	0xFC, 0x1E,             // 20C: I += VC
+	0x7E, 0x01,             // 20E: VE += 1
+	0x4E, 0x80,             // 210: skip if VE != 80
+	0x12, 0x00,             // 212: jump 200
+	0x12, 0x06,             // 214: jump 206
+};
+
+// Calls, skips, timers and CXNN, closer to game code
+static const unsigned char mixedRom[] = {
+	0x6A, 0x00,             // 200: VA = 0
+	0x22, 0x10,             // 202: call 210
+	0x7A, 0x01,             // 204: VA += 1
+	0x3A, 0x00,             // 206: skip if VA == 0
+	0x12, 0x02,             // 208: jump 202
+	0x12, 0x00,             // 20A: jump 200
+	0x00, 0x00,             // 20C
+	0x00, 0x00,             // 20E
+	0x60, 0x05,             // 210: V0 = 5
+	0xF0, 0x15,             // 212: delay = V0
+	0xF1, 0x07,             // 214: V1 = delay
+	0x50, 0x10,             // 216: skip if V0 == V1
+	0x80, 0x14,             // 218: V0 += V1
+	0xC1, 0x0F,             // 21A: V1 = rand & F
+	0x00, 0xEE,             // 21C: return
+};
+
+// FX55/FX65/FX33/DXYN with I past 0xFFF and straddling it, all wrap to 0
+static const unsigned char wrapRom[] = {
+	0x60, 0x10,             // 200: V0 = 10
+	0xAF, 0xF8,             // 202: I = FF8
+	0xF0, 0x1E,             // 204: I += V0 (1008)
+	0xFF, 0x55,             // 206: store V0..VF
+	0xFF, 0x65,             // 208: load V0..VF
+	0xF0, 0x33,             // 20A: BCD of V0
+	0xD0, 0x15,             // 20C: draw 8x5 at V0, V1
+	0xAF, 0xFE,             // 20E: I = FFE
+	0xFF, 0x55,             // 210: store V0..VF
+	0xFF, 0x65,             // 212: load V0..VF
+	0xF0, 0x33,             // 214: BCD of V0
+	0xD0, 0x1F,             // 216: draw 8x15 at V0, V1
+	0x71, 0x01,             // 218: V1 += 1
+	0x12, 0x02,             // 21A: jump 202
+};
+
+const benchRom builtinRoms[] = {
+	{ "arith", arithRom, sizeof(arithRom) },
+	{ "draw", drawRom, sizeof(drawRom) },
+	{ "scroll", scrollRom, sizeof(scrollRom) },
+	{ "memory", memoryRom, sizeof(memoryRom) },
+	{ "mixed", mixedRom, sizeof(mixedRom) },
+	{ "wrap", wrapRom, sizeof(wrapRom) },
+};
+const size_t builtinRomCount = sizeof(builtinRoms) / sizeof(builtinRoms[0]);
+
+struct benchResult {
+	double mips;
+	double frames;
+	// Fused dispatches per chip8Fusion
+	uint64_t fused[chip8FusionCount];
+};
+
+static double seconds(std::chrono::steady_clock::time_point t0) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// One timed run of a ROM from power on
+static bool runOnce(const char* path, bool jit, unsigned int frames, unsigned int ips, benchResult& out) {
+	chip8 c;
+	if (!c.loadGame(path))
+		return false;
+	c.setClockSpeed(ips);
+	if (jit && !c.setJitMode(true))
+		return false;
+
+	uint64_t instructions = 0;
+	unsigned int f = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for (; f < frames && !c.exitFlag; f++) {
+		// Rotating key presses so FX0A waits in real ROMs end
+		c.setKeys((uint16_t)(1 << ((f >> 3) & 0xF)));
+		instructions += c.runFrame();
+	}
+	double t = seconds(t0);
+	out.mips = instructions / t / 1e6;
+	out.frames = f / t;
+	for (unsigned int i = 0; i < chip8FusionCount; i++)
+		out.fused[i] = c.getFusionCount((chip8Fusion)i);
+	return true;
+}
+
+static void report(const std::string& name, const char* mode, const std::vector<benchResult>& runs) {
+	double mean = 0, lo = runs[0].mips, hi = runs[0].mips, frames = 0;
+	for (size_t i = 0; i < runs.size(); i++) {
+		mean += runs[i].mips;
+		frames += runs[i].frames;
+		if (runs[i].mips < lo) lo = runs[i].mips;
+		if (runs[i].mips > hi) hi = runs[i].mips;
+	}
+	mean /= runs.size();
+	frames /= runs.size();
+	double var = 0;
+	for (size_t i = 0; i < runs.size(); i++)
+		var += (runs[i].mips - mean) * (runs[i].mips - mean);
+	double sd = runs.size() > 1 ? sqrt(var / (runs.size() - 1)) : 0;
+	printf("%-16s %-6s %9.2f %9.2f %9.2f %7.2f %8.2f %11.0f\n",
+		name.c_str(), mode, mean, lo, hi, 100.0 * sd / mean, 1000.0 / mean, frames);
+}
+
+static void bench(const std::string& name, const char* path, bool jit, unsigned int reps, unsigned int frames, unsigned int ips) {
+	const char* mode = jit ? "jit" : "interp";
+	benchResult warmup;
+	if (!runOnce(path, jit, frames, ips, warmup)) {
+		printf("%-16s %-6s unavailable\n", name.c_str(), mode);
+		return;
+	}
+	std::vector<benchResult> runs(reps);
+	for (unsigned int r = 0; r < reps; r++)
+		runOnce(path, jit, frames, ips, runs[r]);
+	report(name, mode, runs);
+	// Every run fuses the same way, the warm-up counts stand for all
+	for (unsigned int i = fuseNone + 1; i < chip8FusionCount; i++) {
+		if (warmup.fused[i])
+			printf("#   %-16s %llu\n", chip8FusionName((chip8Fusion)i), (unsigned long long)warmup.fused[i]);
+	}
+}
+
+static std::string baseName(const char* path) {
+	std::string s(path);
+	size_t slash = s.find_last_of("/\\");
+	return slash == std::string::npos ? s : s.substr(slash + 1);
+}
+
+static int usage() {
+	fprintf(stderr, "usage: Chip8Bench [-r reps] [-f frames] [-s ips] [-m interp|jit|all] [rom ...]\n");
+	fprintf(stderr, "       Chip8Bench batch [lanes] [cycles] [rom]\n");
+	fprintf(stderr, "       Chip8Bench replay [-r reps] [-m interp|jit|all] movie rom\n");
+	fprintf(stderr, "       Chip8Bench diff [-c cycles] [-k slice] [-m jit|aot|all] [-o] [rom ...]\n");
+	return 1;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1 && !strcmp(argv[1], "batch"))
+		return batchBench(argc - 1, argv + 1);
+	if (argc > 1 && !strcmp(argv[1], "replay"))
+		return replayBench(argc - 1, argv + 1);
+	if (argc > 1 && !strcmp(argv[1], "diff"))
+		return diffBench(argc - 1, argv + 1);
+
+	unsigned int reps = 5;
+	unsigned int frames = 20000;
+	unsigned int ips = 6000;
+	bool interp = true, jit = true;
+	std::vector<const char*> roms;
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			roms.push_back(argv[i]);
+			continue;
+		}
+		if (i + 1 >= argc)
+			return usage();
+		const char* value = argv[++i];
+		if (!strcmp(argv[i - 1], "-r")) reps = atoi(value);
+		else if (!strcmp(argv[i - 1], "-f")) frames = atoi(value);
+		else if (!strcmp(argv[i - 1], "-s")) ips = atoi(value);
+		else if (!strcmp(argv[i - 1], "-m")) {
+			interp = strcmp(value, "jit") != 0;
+			jit = strcmp(value, "interp") != 0;
+		}
+		else return usage();
+	}
+	if (reps == 0 || frames == 0)
+		return usage();
+
+	printf("# Chip8Bench %u reps, %u frames at %u IPS\n", reps, frames, ips);
+	printf("%-16s %-6s %9s %9s %9s %7s %8s %11s\n",
+		"name", "mode", "MIPS", "min", "max", "sd%", "ns/ins", "frames/s");
+
+	for (size_t i = 0; i < builtinRomCount; i++) {
+		std::string path = std::string("Chip8Bench-") + builtinRoms[i].name + ".ch8";
+		FILE* f = fopen(path.c_str(), "wb");
+		if (!f) return 1;
+		fwrite(builtinRoms[i].data, 1, builtinRoms[i].size, f);
+		fclose(f);
+		if (interp) bench(builtinRoms[i].name, path.c_str(), false, reps, frames, ips);
+		if (jit) bench(builtinRoms[i].name, path.c_str(), true, reps, frames, ips);
+		remove(path.c_str());
+	}
+	for (size_t i = 0; i < roms.size(); i++) {
+		if (interp) bench(baseName(roms[i]), roms[i], false, reps, frames, ips);
+		if (jit) bench(baseName(roms[i]), roms[i], true, reps, frames, ips);
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+/*
+	Chip8Bench entry points
+*/
+#pragma once
+#include <cstddef>
+
+struct benchRom {
+	const char* name;
+	const unsigned char* data;
+	size_t size;
+};
+
+// Synthetic ROMs, one per opcode family
+extern const benchRom builtinRoms[];
+extern const size_t builtinRomCount;
+
+// "Chip8Bench batch [lanes] [cycles] [rom]": chip8Batch against separate chip8 objects
+int batchBench(int argc, char** argv);
+// "Chip8Bench replay [-r reps] [-m mode] movie rom": a recorded movie at full speed
+int replayBench(int argc, char** argv);
+// "Chip8Bench diff [-c cycles] [-k slice] [-m jit|aot|all] [-o] [rom ...]": every engine against the interpreter
+int diffBench(int argc, char** argv);
@@ -0,0 +1,187 @@
+/*
+	Differential check: each execution engine against the interpreter
+
+	Both machines run the same ROM from power on in slices of 'slice'
+	instruction slots with the same rotating key presses, and their save
+	states are compared after every slice. The first difference is
+	reported with the slot range it appeared in and the chip8State field
+	it is in. -o leaves opcode out of the comparison.
+
+	The JIT runs the built-in ROMs and any given ones. The CMake build
+	also translates Chip8Bench/AotCheck.ch8 with Chip8Aot and links the
+	result in (CHIP8_AOT_CHECK); that ROM then runs on the JIT and on its
+	AOT program.
+*/
+#include "Bench.hpp"
+#include "Chip8.hpp"
+#include "Chip8Aot.hpp"
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct stateField {
+	const char* name;
+	size_t offset;
+};
+
+#define STATE_FIELD(f) { #f, offsetof(chip8State, f) }
+// In declaration order, so a byte belongs to the last field at or below it
+static const stateField stateFields[] = {
+	STATE_FIELD(memory), STATE_FIELD(gfx), STATE_FIELD(stack), STATE_FIELD(opcode),
+	STATE_FIELD(pc), STATE_FIELD(I), STATE_FIELD(sp), STATE_FIELD(timerClock),
+	STATE_FIELD(rng), STATE_FIELD(V), STATE_FIELD(RPL), STATE_FIELD(key),
+	STATE_FIELD(delay_timer), STATE_FIELD(sound_timer), STATE_FIELD(drawFlag),
+	STATE_FIELD(beepFlag), STATE_FIELD(exitFlag), STATE_FIELD(fullscreen),
+	STATE_FIELD(awaitKey), STATE_FIELD(pitch), STATE_FIELD(pattern),
+};
+#undef STATE_FIELD
+
+#ifdef CHIP8_AOT_CHECK
+extern const chip8AotProgram chip8Aot_check;
+#endif
+
+// First differing byte, sizeof(chip8State) when equal
+static size_t firstDiff(const chip8State& a, const chip8State& b, bool ignoreOpcode) {
+	const unsigned char* pa = (const unsigned char*)&a;
+	const unsigned char* pb = (const unsigned char*)&b;
+	for (size_t i = 0; i < sizeof(chip8State); i++) {
+		if (ignoreOpcode && i >= offsetof(chip8State, opcode) && i < offsetof(chip8State, opcode) + sizeof(a.opcode))
+			continue;
+		if (pa[i] != pb[i])
+			return i;
+	}
+	return sizeof(chip8State);
+}
+
+static const stateField& fieldAt(size_t offset) {
+	size_t f = 0;
+	while (f + 1 < sizeof(stateFields) / sizeof(stateFields[0]) && stateFields[f + 1].offset <= offset)
+		f++;
+	return stateFields[f];
+}
+
+// Runs the JIT, or aot when given, against the interpreter. False on
+// the first difference.
+static bool diffEngine(const std::string& name, const char* path, const chip8AotProgram* aot,
+	unsigned int cycles, unsigned int slice, bool ignoreOpcode) {
+	const char* engine = aot ? "aot" : "jit";
+	chip8 ref, c;
+	if (!ref.loadGame(path) || !c.loadGame(path)) {
+		printf("%-16s %-6s cannot load\n", name.c_str(), engine);
+		return false;
+	}
+	if (aot && !c.setAotProgram(aot)) {
+		printf("%-16s %-6s translated from another ROM\n", name.c_str(), engine);
+		return false;
+	}
+	if (!aot && !c.setJitMode(true)) {
+		printf("%-16s %-6s unavailable\n", name.c_str(), engine);
+		return true;
+	}
+	chip8State a, b;
+	unsigned int done = 0;
+	for (unsigned int s = 0; done < cycles; s++) {
+		unsigned int n = cycles - done < slice ? cycles - done : slice;
+		// Rotating key presses, as the timed runs use
+		uint16_t keys = (uint16_t)(1 << ((s >> 3) & 0xF));
+		ref.setKeys(keys);
+		c.setKeys(keys);
+		ref.runFor(n);
+		c.runFor(n);
+		ref.saveState(a);
+		c.saveState(b);
+		size_t at = firstDiff(a, b, ignoreOpcode);
+		if (at < sizeof(chip8State)) {
+			const stateField& f = fieldAt(at);
+			printf("%-16s %-6s differs in slots %u..%u: %s+%u (%02X, interp %02X), pc %03X vs %03X\n",
+				name.c_str(), engine, done, done + n - 1, f.name, (unsigned int)(at - f.offset),
+				((const unsigned char*)&b)[at], ((const unsigned char*)&a)[at], b.pc, a.pc);
+			return false;
+		}
+		done += n;
+		if (ref.exitFlag)
+			break;
+	}
+	printf("%-16s %-6s same for %u slots\n", name.c_str(), engine, done);
+	return true;
+}
+
+static int diffUsage() {
+	fprintf(stderr, "usage: Chip8Bench diff [-c cycles] [-k slice] [-m jit|aot|all] [-o] [rom ...]\n");
+	return 1;
+}
+
+// argv[0] is the "diff" command
+int diffBench(int argc, char** argv) {
+	unsigned int cycles = 1000000;
+	unsigned int slice = 1000;
+	bool ignoreOpcode = false;
+	bool jit = true, aot = true;
+	std::vector<const char*> roms;
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			roms.push_back(argv[i]);
+			continue;
+		}
+		if (!strcmp(argv[i], "-o")) {
+			ignoreOpcode = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return diffUsage();
+		const char* value = argv[++i];
+		if (!strcmp(argv[i - 1], "-c")) cycles = atoi(value);
+		else if (!strcmp(argv[i - 1], "-k")) slice = atoi(value);
+		else if (!strcmp(argv[i - 1], "-m")) {
+			jit = strcmp(value, "aot") != 0;
+			aot = strcmp(value, "jit") != 0;
+		}
+		else return diffUsage();
+	}
+	if (cycles == 0 || slice == 0)
+		return diffUsage();
+
+	unsigned int failed = 0;
+	for (size_t i = 0; jit && i < builtinRomCount; i++) {
+		std::string path = std::string("Chip8Bench-") + builtinRoms[i].name + ".ch8";
+		FILE* f = fopen(path.c_str(), "wb");
+		if (!f) return 1;
+		fwrite(builtinRoms[i].data, 1, builtinRoms[i].size, f);
+		fclose(f);
+		if (!diffEngine(builtinRoms[i].name, path.c_str(), nullptr, cycles, slice, ignoreOpcode))
+			failed++;
+		remove(path.c_str());
+	}
+#ifdef CHIP8_AOT_CHECK
+	{
+		// The program carries its ROM image
+		const char* path = "Chip8Bench-aotcheck.ch8";
+		FILE* f = fopen(path, "wb");
+		if (!f) return 1;
+		fwrite(chip8Aot_check.image, 1, chip8Aot_check.size, f);
+		fclose(f);
+		if (jit && !diffEngine("aotcheck", path, nullptr, cycles, slice, ignoreOpcode))
+			failed++;
+		if (aot && !diffEngine("aotcheck", path, &chip8Aot_check, cycles, slice, ignoreOpcode))
+			failed++;
+		remove(path);
+	}
+#else
+	if (aot && !jit) {
+		fprintf(stderr, "no AOT program linked in\n");
+		return 1;
+	}
+#endif
+	for (size_t i = 0; jit && i < roms.size(); i++) {
+		std::string name(roms[i]);
+		size_t slash = name.find_last_of("/\\");
+		if (slash != std::string::npos)
+			name = name.substr(slash + 1);
+		if (!diffEngine(name, roms[i], nullptr, cycles, slice, ignoreOpcode))
+			failed++;
+	}
+	return failed ? 1 : 0;
+}
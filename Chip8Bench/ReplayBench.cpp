@@ -0,0 +1,100 @@
+/*
+	Movie replay benchmark: a recorded session (see Chip8Movie.hpp) run at
+	full speed. Every repetition executes the same instruction stream, so
+	the numbers compare across builds, and a repetition whose checkpoints
+	do not match is reported instead of timed.
+*/
+#include "Bench.hpp"
+#include "Chip8.hpp"
+#include "Chip8Movie.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static int replayUsage() {
+	fprintf(stderr, "usage: Chip8Bench replay [-r reps] [-m interp|jit|all] movie rom\n");
+	return 1;
+}
+
+// One timed replay, false if the movie does not fit the ROM or diverged
+static bool replayOnce(const chip8Movie& movie, const char* rom, bool jit, double& mips) {
+	chip8 c;
+	if (!movie.start(c, rom)) {
+		printf("# %s is not the recorded ROM\n", rom);
+		return false;
+	}
+	if (jit && !c.setJitMode(true))
+		return false;
+	chip8MovieResult r;
+	auto t0 = std::chrono::steady_clock::now();
+	movie.replay(c, r);
+	double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+	if (r.failed) {
+		printf("# checkpoint at frame %u: expected %016llx, got %016llx\n", r.badFrame,
+			(unsigned long long)r.expected, (unsigned long long)r.actual);
+		return false;
+	}
+	mips = r.cycles / t / 1e6;
+	return true;
+}
+
+// argv[0] is the "replay" command
+int replayBench(int argc, char** argv) {
+	unsigned int reps = 5;
+	bool interp = true, jit = true;
+	std::vector<const char*> files;
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			files.push_back(argv[i]);
+			continue;
+		}
+		if (i + 1 >= argc)
+			return replayUsage();
+		const char* value = argv[++i];
+		if (!strcmp(argv[i - 1], "-r")) reps = atoi(value);
+		else if (!strcmp(argv[i - 1], "-m")) {
+			interp = strcmp(value, "jit") != 0;
+			jit = strcmp(value, "interp") != 0;
+		}
+		else return replayUsage();
+	}
+	if (files.size() != 2 || reps == 0)
+		return replayUsage();
+
+	chip8Movie movie;
+	if (!movie.load(files[0])) {
+		fprintf(stderr, "cannot read movie %s\n", files[0]);
+		return 1;
+	}
+	printf("# %u frames, %llu cycles, %zu key changes, %zu checkpoints\n", movie.frames(),
+		(unsigned long long)movie.cycles(), movie.keyChanges().size(), movie.checkpointList().size());
+	printf("%-6s %9s %9s %9s\n", "mode", "MIPS", "min", "max");
+	int failed = 0;
+	for (int m = 0; m < 2; m++) {
+		bool useJit = m == 1;
+		if (useJit ? !jit : !interp)
+			continue;
+		const char* mode = useJit ? "jit" : "interp";
+		double mips;
+		// Warm-up, also checks the movie replays at all
+		if (!replayOnce(movie, files[1], useJit, mips)) {
+			printf("%-6s failed\n", mode);
+			failed = 1;
+			continue;
+		}
+		double sum = 0, lo = 0, hi = 0;
+		for (unsigned int r = 0; r < reps; r++) {
+			if (!replayOnce(movie, files[1], useJit, mips)) {
+				failed = 1;
+				break;
+			}
+			sum += mips;
+			lo = r == 0 || mips < lo ? mips : lo;
+			hi = mips > hi ? mips : hi;
+		}
+		printf("%-6s %9.2f %9.2f %9.2f\n", mode, sum / reps, lo, hi);
+	}
+	return failed;
+}
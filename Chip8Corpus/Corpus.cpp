@@ -0,0 +1,411 @@
+/*
+	Chip8 ROM corpus runner
+
+	Chip8Corpus [-f frames] [-s ips] [-j threads] [-m interp|jit] [-p platform] [-u] [-r] [-c every] dir
+
+	Runs every ROM (.ch8, .c8, .sc8, .xo8) in 'dir' for 'frames' frames on a
+	work-stealing thread pool and hashes gfx (XXH64) after every frame.
+	The hashes are compared against '<rom>.golden' next to the ROM; -u
+	writes the golden files instead. A ROM without one is reported NEW, one
+	whose golden file does not parse as an ERROR. Exits with 1 when any
+	ROM fails or errs.
+	Each ROM runs with the quirk profile its extension implies (see
+	chip8PlatformForFile) unless -p names one for all of them.
+
+	'<rom>.keys' optionally scripts the keypad, one event per line:
+	'frame key' presses hex key 0-F from that frame on (releasing the one
+	held before), 'frame -' releases it. '#' starts a comment.
+
+	Golden files are text: a '# frames ips platform' header, then one hash
+	per frame. Headers without the platform (older files) stand for the
+	profile of the ROM's extension.
+
+	-r records '<rom>.movie' instead (see Chip8Movie.hpp): the same run
+	with the same script, kept as key changes with the ROM hash, platform,
+	clock speed and seed, and a frame hash every 'every' frames (default
+	60). A ROM with a movie is checked by replaying it at full speed, which
+	takes precedence over the golden file; -f, -s and -p do not apply.
+*/
+#include "Chip8.hpp"
+#include "Chip8Hash.hpp"
+#include "Chip8Movie.hpp"
+#include "WorkPool.hpp"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// Fixed CXNN seed so runs are reproducible
+static const uint32_t CORPUS_SEED = 0xC00C1E;
+
+struct keyEvent {
+	unsigned int frame;
+	int key;                // -1 releases
+};
+
+struct romResult {
+	// Lower case, windows.h defines ERROR
+	enum status { pass, fail, unrecorded, recorded, error } result;
+	unsigned int frames;
+	// First mismatching frame and its hashes when result is fail
+	unsigned int badFrame;
+	uint64_t expected, actual;
+	std::string message;
+	double seconds;
+};
+
+struct corpusOptions {
+	unsigned int frames;
+	unsigned int ips;
+	bool jit;
+	bool update;
+	// Write movies, with a checkpoint every checkpointEvery frames
+	bool record;
+	unsigned int checkpointEvery;
+	// Quirk profile for every ROM when forcePlatform is set
+	bool forcePlatform;
+	chip8Platform platform;
+};
+
+static bool hasRomExtension(const std::string& name) {
+	size_t dot = name.find_last_of('.');
+	if (dot == std::string::npos)
+		return false;
+	std::string ext = name.substr(dot + 1);
+	for (size_t i = 0; i < ext.size(); i++)
+		ext[i] = (char)tolower((unsigned char)ext[i]);
+	return ext == "ch8" || ext == "c8" || ext == "sc8" || ext == "xo8";
+}
+
+// Sorted ROM file names in dir
+static std::vector<std::string> listRoms(const std::string& dir) {
+	std::vector<std::string> names;
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE h = FindFirstFileA((dir + "\\*").c_str(), &found);
+	if (h != INVALID_HANDLE_VALUE) {
+		do {
+			if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && hasRomExtension(found.cFileName))
+				names.push_back(found.cFileName);
+		} while (FindNextFileA(h, &found));
+		FindClose(h);
+	}
+#else
+	DIR* d = opendir(dir.c_str());
+	if (d) {
+		while (dirent* e = readdir(d)) {
+			if (e->d_name[0] != '.' && hasRomExtension(e->d_name))
+				names.push_back(e->d_name);
+		}
+		closedir(d);
+	}
+#endif
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+// Missing file = no events
+static bool readKeys(const std::string& path, std::vector<keyEvent>& events) {
+	FILE* f = fopen(path.c_str(), "r");
+	if (!f)
+		return true;
+	char line[256];
+	bool ok = true;
+	while (fgets(line, sizeof(line), f)) {
+		char* hash = strchr(line, '#');
+		if (hash)
+			*hash = 0;
+		unsigned int frame;
+		char key[8];
+		int n = sscanf(line, "%u %7s", &frame, key);
+		if (n <= 0)
+			continue;
+		if (n != 2) {
+			ok = false;
+			break;
+		}
+		keyEvent e;
+		e.frame = frame;
+		if (!strcmp(key, "-"))
+			e.key = -1;
+		else {
+			char* end;
+			e.key = (int)strtol(key, &end, 16);
+			if (*end || e.key < 0 || e.key > 0xF) {
+				ok = false;
+				break;
+			}
+		}
+		events.push_back(e);
+	}
+	fclose(f);
+	std::stable_sort(events.begin(), events.end(),
+		[](const keyEvent& a, const keyEvent& b) { return a.frame < b.frame; });
+	return ok;
+}
+
+// False if the file cannot be read or is malformed. platform is left
+// alone when the header does not name one.
+static bool readGolden(const std::string& path, unsigned int& ips, chip8Platform& platform, std::vector<uint64_t>& hashes) {
+	FILE* f = fopen(path.c_str(), "r");
+	if (!f)
+		return false;
+	char line[64], name[16];
+	unsigned int frames;
+	int fields = fgets(line, sizeof(line), f) ? sscanf(line, "# %u %u %15s", &frames, &ips, name) : 0;
+	bool ok = fields == 2 || (fields == 3 && chip8PlatformFromName(name, platform));
+	unsigned long long h;
+	while (ok && hashes.size() < frames && fscanf(f, "%llx", &h) == 1)
+		hashes.push_back(h);
+	fclose(f);
+	return ok && hashes.size() == frames;
+}
+
+static bool writeGolden(const std::string& path, unsigned int ips, chip8Platform platform, const std::vector<uint64_t>& hashes) {
+	FILE* f = fopen(path.c_str(), "w");
+	if (!f)
+		return false;
+	fprintf(f, "# %u %u %s\n", (unsigned int)hashes.size(), ips, chip8PlatformQuirks(platform).name);
+	for (size_t i = 0; i < hashes.size(); i++)
+		fprintf(f, "%016llx\n", (unsigned long long)hashes[i]);
+	return fclose(f) == 0;
+}
+
+static bool fileExists(const std::string& path) {
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f)
+		fclose(f);
+	return f != NULL;
+}
+
+// Checks a ROM against its movie
+static void replayRom(const std::string& path, const std::string& moviePath, const corpusOptions& opt, romResult& r) {
+	chip8Movie movie;
+	if (!movie.load(moviePath.c_str())) {
+		r.result = romResult::error;
+		r.message = "bad .movie file";
+		return;
+	}
+	chip8 c;
+	if (!movie.start(c, path.c_str())) {
+		r.result = romResult::error;
+		r.message = "movie recorded from another ROM";
+		return;
+	}
+	if (opt.jit)
+		c.setJitMode(true);
+	chip8MovieResult m;
+	movie.replay(c, m);
+	r.frames = movie.frames();
+	r.result = m.failed ? romResult::fail : romResult::pass;
+	r.badFrame = m.badFrame;
+	r.expected = m.expected;
+	r.actual = m.actual;
+}
+
+static void runRom(const std::string& path, const corpusOptions& opt, romResult& r) {
+	auto t0 = std::chrono::steady_clock::now();
+	r.frames = 0;
+	r.badFrame = 0;
+	r.expected = r.actual = 0;
+
+	std::string moviePath = path + ".movie";
+	if (!opt.update && !opt.record && fileExists(moviePath)) {
+		replayRom(path, moviePath, opt, r);
+		r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		return;
+	}
+
+	std::vector<keyEvent> events;
+	if (!readKeys(path + ".keys", events)) {
+		r.result = romResult::error;
+		r.message = "bad .keys file";
+		return;
+	}
+	chip8 c;
+	if (!c.loadGame(path.c_str())) {
+		r.result = romResult::error;
+		r.message = "cannot load";
+		return;
+	}
+	c.seed(CORPUS_SEED);
+	c.setClockSpeed(opt.ips);
+	chip8Platform platform = opt.forcePlatform ? opt.platform : chip8PlatformForFile(path.c_str());
+	c.setPlatform(platform);
+	if (opt.jit)
+		c.setJitMode(true);
+	chip8Movie movie;
+	uint64_t romHash = 0;
+	if (opt.record && (!chip8Movie::hashRom(path.c_str(), romHash) || !movie.begin(c, romHash, opt.checkpointEvery))) {
+		r.result = romResult::error;
+		r.message = "cannot start movie";
+		return;
+	}
+
+	std::vector<uint64_t> hashes(opt.frames);
+	size_t next = 0;
+	for (unsigned int f = 0; f < opt.frames; f++) {
+		for (; next < events.size() && events[next].frame <= f; next++) {
+			if (events[next].key < 0)
+				c.clearKey();
+			else
+				c.setKeys((uint16_t)(1 << events[next].key));
+		}
+		if (opt.record)
+			movie.input(c);
+		c.runFrame();
+		if (opt.record)
+			movie.frame(c);
+		hashes[f] = chip8Hash64(c.gfx, sizeof(c.gfx));
+	}
+	r.frames = opt.frames;
+
+	if (opt.record) {
+		movie.end(c);
+		r.result = movie.save(moviePath.c_str()) ? romResult::recorded : romResult::error;
+		if (r.result == romResult::error)
+			r.message = "cannot write .movie file";
+		r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+		return;
+	}
+
+	std::string golden = path + ".golden";
+	if (opt.update) {
+		r.result = writeGolden(golden, opt.ips, platform, hashes) ? romResult::recorded : romResult::error;
+		if (r.result == romResult::error)
+			r.message = "cannot write .golden file";
+	}
+	else {
+		unsigned int ips;
+		chip8Platform recorded = chip8PlatformForFile(path.c_str());
+		std::vector<uint64_t> expected;
+		// Only a missing golden is new, one that does not parse fails the run
+		if (!fileExists(golden))
+			r.result = romResult::unrecorded;
+		else if (!readGolden(golden, ips, recorded, expected)) {
+			r.result = romResult::error;
+			r.message = "bad .golden file";
+		}
+		else if (ips != opt.ips) {
+			r.result = romResult::fail;
+			r.message = "golden recorded at " + std::to_string(ips) + " IPS";
+		}
+		else if (recorded != platform) {
+			r.result = romResult::fail;
+			r.message = std::string("golden recorded on ") + chip8PlatformQuirks(recorded).name;
+		}
+		else {
+			// Frames past the end of the golden file are not checked
+			r.result = romResult::pass;
+			size_t n = std::min(expected.size(), hashes.size());
+			for (size_t f = 0; f < n; f++) {
+				if (expected[f] != hashes[f]) {
+					r.result = romResult::fail;
+					r.badFrame = (unsigned int)f;
+					r.expected = expected[f];
+					r.actual = hashes[f];
+					break;
+				}
+			}
+		}
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static int usage() {
+	fprintf(stderr, "usage: Chip8Corpus [-f frames] [-s ips] [-j threads] [-m interp|jit] [-p platform] [-u] [-r] [-c every] dir\n");
+	fprintf(stderr, "       platform: default, chip8, chip48, schip11 or xochip\n");
+	return 2;
+}
+
+int main(int argc, char** argv) {
+	corpusOptions opt;
+	opt.frames = 600;
+	opt.ips = 600;
+	opt.jit = false;
+	opt.update = false;
+	opt.record = false;
+	opt.checkpointEvery = 60;
+	opt.forcePlatform = false;
+	opt.platform = platformDefault;
+	unsigned int threads = 0;
+	const char* dir = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			if (dir)
+				return usage();
+			dir = argv[i];
+			continue;
+		}
+		if (!strcmp(argv[i], "-u")) {
+			opt.update = true;
+			continue;
+		}
+		if (!strcmp(argv[i], "-r")) {
+			opt.record = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+			return usage();
+		const char* value = argv[++i];
+		if (!strcmp(argv[i - 1], "-f")) opt.frames = atoi(value);
+		else if (!strcmp(argv[i - 1], "-s")) opt.ips = atoi(value);
+		else if (!strcmp(argv[i - 1], "-j")) threads = atoi(value);
+		else if (!strcmp(argv[i - 1], "-c")) opt.checkpointEvery = atoi(value);
+		else if (!strcmp(argv[i - 1], "-m")) opt.jit = !strcmp(value, "jit");
+		else if (!strcmp(argv[i - 1], "-p")) {
+			if (!chip8PlatformFromName(value, opt.platform))
+				return usage();
+			opt.forcePlatform = true;
+		}
+		else return usage();
+	}
+	if (!dir || opt.frames == 0 || opt.ips == 0 || opt.checkpointEvery == 0 || (opt.update && opt.record))
+		return usage();
+
+	std::vector<std::string> roms = listRoms(dir);
+	if (roms.empty()) {
+		fprintf(stderr, "no ROMs in %s\n", dir);
+		return 2;
+	}
+
+	workPool pool(threads);
+	std::vector<romResult> results(roms.size());
+	auto t0 = std::chrono::steady_clock::now();
+	pool.run(roms.size(), [&](size_t i) {
+		runRom(std::string(dir) + "/" + roms[i], opt, results[i]);
+	});
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	// Reported in name order once everything is done, so output is stable
+	static const char* names[] = { "PASS", "FAIL", "NEW", "RECORDED", "ERROR" };
+	unsigned int count[5] = {};
+	for (size_t i = 0; i < roms.size(); i++) {
+		const romResult& r = results[i];
+		count[r.result]++;
+		printf("%-8s %-32s", names[r.result], roms[i].c_str());
+		if (r.result == romResult::fail && r.message.empty())
+			printf(" frame %u: expected %016llx, got %016llx", r.badFrame,
+				(unsigned long long)r.expected, (unsigned long long)r.actual);
+		else if (!r.message.empty())
+			printf(" %s", r.message.c_str());
+		else
+			printf(" %u frames, %.3f s", r.frames, r.seconds);
+		printf("\n");
+	}
+	printf("# %u ROMs, %u frames at %u IPS on %u threads in %.2f s: %u pass, %u fail, %u new, %u recorded, %u error\n",
+		(unsigned int)roms.size(), opt.frames, opt.ips, pool.size(), total,
+		count[romResult::pass], count[romResult::fail], count[romResult::unrecorded],
+		count[romResult::recorded], count[romResult::error]);
+	return count[romResult::fail] + count[romResult::error] > 0 ? 1 : 0;
+}
@@ -0,0 +1,55 @@
+/*
+	Work-stealing thread pool
+*/
+#include "WorkPool.hpp"
+#include <thread>
+
+workPool::workPool(unsigned int n) {
+	if (n == 0)
+		n = std::thread::hardware_concurrency();
+	threads = n > 0 ? n : 1;
+	for (unsigned int i = 0; i < threads; i++)
+		queues.push_back(std::unique_ptr<queue>(new queue()));
+}
+
+void workPool::run(size_t count, const std::function<void(size_t)>& job) {
+	for (size_t i = 0; i < count; i++)
+		queues[i % threads]->jobs.push_back(i);
+
+	// The calling thread is worker 0
+	std::vector<std::thread> pool;
+	for (unsigned int t = 1; t < threads; t++)
+		pool.push_back(std::thread(&workPool::worker, this, t, std::cref(job)));
+	worker(0, job);
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+}
+
+void workPool::worker(unsigned int self, const std::function<void(size_t)>& job) {
+	size_t next;
+	while (take(self, next))
+		job(next);
+}
+
+bool workPool::take(unsigned int self, size_t& job) {
+	{
+		queue& own = *queues[self];
+		std::lock_guard<std::mutex> hold(own.lock);
+		if (!own.jobs.empty()) {
+			job = own.jobs.back();
+			own.jobs.pop_back();
+			return true;
+		}
+	}
+	// No job is ever added during a run, so one empty pass means done
+	for (unsigned int i = 1; i < threads; i++) {
+		queue& victim = *queues[(self + i) % threads];
+		std::lock_guard<std::mutex> hold(victim.lock);
+		if (!victim.jobs.empty()) {
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
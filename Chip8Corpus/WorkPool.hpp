@@ -0,0 +1,37 @@
+/*
+	Work-stealing thread pool
+
+	Jobs are indices dealt round-robin onto one deque per worker. A worker
+	takes from the back of its own deque and, once that is empty, steals
+	from the front of the others, so a few slow ROMs do not leave the rest
+	of the cores idle at the end of a run.
+*/
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class workPool {
+public:
+	// 0 threads = one per hardware thread
+	workPool(unsigned int threads = 0);
+	// Runs job(i) for every i in [0, count) and returns when all are done
+	void run(size_t count, const std::function<void(size_t)>& job);
+	unsigned int size() const { return threads; }
+
+private:
+	struct queue {
+		std::mutex lock;
+		std::deque<size_t> jobs;
+	};
+
+	unsigned int threads;
+	std::vector<std::unique_ptr<queue>> queues;
+
+	void worker(unsigned int self, const std::function<void(size_t)>& job);
+	// Next job for worker 'self', false once every queue is empty
+	bool take(unsigned int self, size_t& job);
+};
@@ -0,0 +1,138 @@
+﻿using System;
+using System.Runtime.InteropServices;
+using System.Security;
+
+namespace Chip8Desktop
+{
+    // Mirrors chip8View in Chip8/Chip8Api.hpp
+    [StructLayout(LayoutKind.Sequential)]
+    public struct Chip8View
+    {
+        public IntPtr Gfx;
+        public ulong Rows;
+        public uint Cycles;
+        public ushort Left, Top, Right, Bottom;
+        public byte Dirty;
+        public byte Fullscreen;
+        public byte Beep;
+        public byte Exited;
+    }
+
+    // P/Invoke declarations of the core's C interface. Only blittable
+    // arguments on the run calls, so they cost a plain native call.
+    [SuppressUnmanagedCodeSecurity]
+    internal static class Chip8Native
+    {
+        const string Dll = "Chip8.dll";
+
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr chip8Create();
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void chip8Destroy(IntPtr c);
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi, BestFitMapping = false)]
+        public static extern int chip8Load(IntPtr c, string path);
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void chip8Reset(IntPtr c);
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void chip8SetClockSpeed(IntPtr c, uint ips);
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl)]
+        public static extern void chip8SetFastForward(IntPtr c, uint factor);
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl, CharSet = CharSet.Ansi, BestFitMapping = false)]
+        public static extern int chip8SetPlatform(IntPtr c, string name);
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl)]
+        public static extern IntPtr chip8GetView(IntPtr c);
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl)]
+        public static extern uint chip8RunCycles(IntPtr c, ushort keys, uint cycles);
+        [DllImport(Dll, CallingConvention = CallingConvention.Cdecl)]
+        public static extern uint chip8RunFrame(IntPtr c, ushort keys);
+    }
+
+    // One native core. View and Gfx point into native memory owned by the
+    // instance and are updated in place by every Run call.
+    public sealed unsafe class Chip8Core : IDisposable
+    {
+        IntPtr handle;
+        Chip8View* view;
+
+        public Chip8Core()
+        {
+            handle = Chip8Native.chip8Create();
+            if (handle == IntPtr.Zero)
+                throw new OutOfMemoryException();
+            view = (Chip8View*)Chip8Native.chip8GetView(handle);
+        }
+
+        ~Chip8Core()
+        {
+            Release();
+        }
+
+        public void Dispose()
+        {
+            Release();
+            GC.SuppressFinalize(this);
+        }
+
+        void Release()
+        {
+            if (handle == IntPtr.Zero)
+                return;
+            Chip8Native.chip8Destroy(handle);
+            handle = IntPtr.Zero;
+            view = null;
+        }
+
+        public bool Load(string path)
+        {
+            return Chip8Native.chip8Load(handle, path) != 0;
+        }
+
+        public void Reset()
+        {
+            Chip8Native.chip8Reset(handle);
+        }
+
+        public uint ClockSpeed
+        {
+            set { Chip8Native.chip8SetClockSpeed(handle, value); }
+        }
+
+        public uint FastForward
+        {
+            set { Chip8Native.chip8SetFastForward(handle, value); }
+        }
+
+        public bool SetPlatform(string name)
+        {
+            return Chip8Native.chip8SetPlatform(handle, name) != 0;
+        }
+
+        // Bit k of keys = key k pressed
+        public uint RunFrame(ushort keys)
+        {
+            return Chip8Native.chip8RunFrame(handle, keys);
+        }
+
+        public uint RunCycles(ushort keys, uint cycles)
+        {
+            return Chip8Native.chip8RunCycles(handle, keys, cycles);
+        }
+
+        public Chip8View* View
+        {
+            get { return view; }
+        }
+
+        // 128 words, see chip8View.gfx
+        public ulong* Gfx
+        {
+            get { return (ulong*)view->Gfx; }
+        }
+
+        public bool Pixel(int x, int y)
+        {
+            int wpr = view->Fullscreen != 0 ? 2 : 1;
+            return ((Gfx[y * wpr + (x >> 6)] >> (63 - (x & 63))) & 1) != 0;
+        }
+    }
+}
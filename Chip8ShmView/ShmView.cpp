@@ -0,0 +1,287 @@
+/*
+	Chip8 shared-memory server, viewer and benchmark
+
+	Chip8ShmView serve [-n name] [-s ips] [-p platform] rom
+	Chip8ShmView view [-n name]
+	Chip8ShmView bench [-n name] [-f frames] [-v viewers] [-r rate]
+
+	serve runs a ROM headless at 60 frames per second and publishes every
+	frame into the shared-memory region 'name' (default "cookiechip"),
+	applying key states viewers send.
+
+	view maps the region and draws each new frame as text. It stands in
+	for a real front end, and any number of them can watch one server.
+
+	bench measures the transport itself in one process: a producer
+	publishes 'frames' frames (default 40000), 'rate' per second (default
+	20000; 0 = back to back, yielding after each), while 'viewers' threads
+	each map the region and read every frame they can in place. It reports
+	the publish rate, frames seen and torn reads retried per viewer,
+	publish to read latency, and the round trip of a key state sent by the
+	first viewer until a frame carrying it is read. Exits with 1 if a
+	viewer accepted a torn frame, or read fewer than a tenth of the frames,
+	too few for the torn check to mean anything.
+*/
+#include "Chip8.hpp"
+#include "Chip8Clock.hpp"
+#include "Chip8Shm.hpp"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static int usage() {
+	fprintf(stderr, "usage: Chip8ShmView serve [-n name] [-s ips] [-p platform] rom\n");
+	fprintf(stderr, "       Chip8ShmView view [-n name]\n");
+	fprintf(stderr, "       Chip8ShmView bench [-n name] [-f frames] [-v viewers] [-r rate]\n");
+	fprintf(stderr, "       platform: default, chip8, chip48, schip11 or xochip\n");
+	return 2;
+}
+
+struct shmOptions {
+	const char* name;
+	const char* rom;
+	unsigned int ips;
+	bool forcePlatform;
+	chip8Platform platform;
+	unsigned int frames;
+	unsigned int viewers;
+	// Frames per second for bench, 0 = as fast as possible
+	unsigned int rate;
+};
+
+////////////// serve ////////////////////////////
+
+// Set on Ctrl+C so the region is closed and its name removed
+static volatile std::sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+	stopRequested = 1;
+}
+
+static int serve(const shmOptions& opt) {
+	chip8 c;
+	c.initialize();
+	c.setPlatform(opt.forcePlatform ? opt.platform : chip8PlatformForFile(opt.rom));
+	c.setClockSpeed(opt.ips);
+	if (!c.loadGame(opt.rom)) {
+		fprintf(stderr, "cannot load %s\n", opt.rom);
+		return 1;
+	}
+	chip8Shm shm;
+	if (!shm.create(opt.name)) {
+		fprintf(stderr, "cannot create region %s\n", opt.name);
+		return 1;
+	}
+	printf("serving %s as %s\n", opt.rom, opt.name);
+	fflush(stdout);
+	std::signal(SIGINT, requestStop);
+	std::signal(SIGTERM, requestStop);
+	const std::chrono::nanoseconds frame(1000000000 / 60);
+	std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+	while (!c.exitFlag && !stopRequested) {
+		shm.pollInput(c);
+		c.runFrame();
+		shm.publish(c);
+		next += frame;
+		std::this_thread::sleep_until(next);
+	}
+	return 0;
+}
+
+////////////// view ////////////////////////////
+
+static int view(const shmOptions& opt) {
+	chip8Shm shm;
+	if (!shm.open(opt.name)) {
+		fprintf(stderr, "no region %s\n", opt.name);
+		return 1;
+	}
+	chip8ShmFrame f;
+	uint64_t shown = 0;
+	std::vector<char> text(129 * 64 + 1);
+	while (!shm.closed()) {
+		if (shm.frameCount() == shown || !shm.readFrame(f)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+		shown = f.number;
+		unsigned int wpr = f.fullscreen ? 2 : 1;
+		unsigned int w = 64 * wpr, h = 32 * wpr;
+		char* p = text.data();
+		for (unsigned int y = 0; y < h; y++) {
+			for (unsigned int x = 0; x < w; x++)
+				*p++ = (f.gfx[y * wpr + (x >> 6)] >> (63 - (x & 63))) & 0x1 ? '#' : ' ';
+			*p++ = '\n';
+		}
+		*p = '\0';
+		// Cursor home, then the frame over the previous one
+		printf("\x1b[H%sframe %llu\x1b[J", text.data(), (unsigned long long)f.number);
+		fflush(stdout);
+		if (f.exited)
+			break;
+	}
+	printf("\n");
+	return 0;
+}
+
+////////////// bench ////////////////////////////
+
+struct viewerStats {
+	uint64_t frames;
+	uint64_t retries;
+	// Frames whose words did not all carry the same frame number
+	uint64_t torn;
+	uint64_t latencySum;
+	uint64_t latencyMax;
+	uint64_t inputs;
+	uint64_t inputSum;
+};
+
+// Reads frames in place until the producer closes the region
+static void benchViewer(const char* name, bool sendsKeys, viewerStats& s) {
+	memset(&s, 0x0, sizeof(s));
+	chip8Shm shm;
+	if (!shm.open(name))
+		return;
+	const chip8ShmRegion* r = shm.data();
+	uint64_t last = 0, lastInput = 0;
+	bool waiting = false;
+	while (!shm.closed()) {
+		uint64_t seq = shm.beginRead();
+		if (seq == last) {
+			std::this_thread::yield();
+			continue;
+		}
+		uint64_t first = r->gfx[0];
+		bool same = true;
+		for (int i = 1; i < 128; i++)
+			same &= r->gfx[i] == first;
+		uint64_t published = r->published, input = r->inputSent;
+		if (!shm.endRead(seq)) {
+			s.retries++;
+			continue;
+		}
+		uint64_t now = chip8Now();
+		last = seq;
+		s.frames++;
+		s.torn += !same;
+		uint64_t latency = now > published ? now - published : 0;
+		s.latencySum += latency;
+		if (latency > s.latencyMax)
+			s.latencyMax = latency;
+		if (!sendsKeys)
+			continue;
+		if (waiting && input != lastInput) {
+			s.inputs++;
+			s.inputSum += now - input;
+			waiting = false;
+		}
+		lastInput = input;
+		if (!waiting)
+			waiting = shm.sendKeys((uint16_t)(s.frames & 0xFFFF));
+	}
+}
+
+static int bench(const shmOptions& opt) {
+	chip8Shm shm;
+	if (!shm.create(opt.name)) {
+		fprintf(stderr, "cannot create region %s\n", opt.name);
+		return 1;
+	}
+	chip8 c;
+	c.initialize();
+	std::vector<viewerStats> stats(opt.viewers);
+	std::vector<std::thread> viewers;
+	for (unsigned int v = 0; v < opt.viewers; v++)
+		viewers.emplace_back(benchViewer, opt.name, v == 0, std::ref(stats[v]));
+	// Let the viewers map the region first
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (uint64_t f = 1; f <= opt.frames; f++) {
+		shm.pollInput(c);
+		for (int i = 0; i < 128; i++)
+			c.gfx[i] = f;
+		shm.publish(c);
+		// Back to back, the producer still gives the viewers a turn so they
+		// do not only ever see the sequence odd (mid publish)
+		if (opt.rate)
+			std::this_thread::sleep_until(start + std::chrono::nanoseconds(f * 1000000000ull / opt.rate));
+		else
+			std::this_thread::yield();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	shm.close();
+	for (std::thread& t : viewers)
+		t.join();
+
+	printf("%u frames published in %.3f s, %.0f frames/s, %zu bytes mapped\n",
+		opt.frames, seconds, opt.frames / seconds, sizeof(chip8ShmRegion));
+	int failed = 0;
+	for (unsigned int v = 0; v < opt.viewers; v++) {
+		const viewerStats& s = stats[v];
+		printf("viewer %u: %llu frames, %llu retried, %llu torn, latency mean %.1f us max %.1f us",
+			v, (unsigned long long)s.frames, (unsigned long long)s.retries, (unsigned long long)s.torn,
+			s.frames ? s.latencySum / 1000.0 / s.frames : 0.0, s.latencyMax / 1000.0);
+		if (s.inputs)
+			printf(", input round trip %.1f us over %llu", s.inputSum / 1000.0 / s.inputs, (unsigned long long)s.inputs);
+		printf("\n");
+		failed |= s.torn != 0;
+		if (s.frames < opt.frames / 10) {
+			printf("viewer %u: too few frames read to check, need %u\n", v, opt.frames / 10);
+			failed = 1;
+		}
+	}
+	return failed;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2)
+		return usage();
+	shmOptions opt;
+	opt.name = "cookiechip";
+	opt.rom = NULL;
+	opt.ips = 600;
+	opt.forcePlatform = false;
+	opt.platform = platformDefault;
+	opt.frames = 40000;
+	opt.viewers = 2;
+	opt.rate = 20000;
+	for (int i = 2; i < argc; i++) {
+		if (argv[i][0] != '-') {
+			if (opt.rom)
+				return usage();
+			opt.rom = argv[i];
+			continue;
+		}
+		if (i + 1 >= argc)
+			return usage();
+		const char* value = argv[++i];
+		if (!strcmp(argv[i - 1], "-n")) opt.name = value;
+		else if (!strcmp(argv[i - 1], "-s")) opt.ips = atoi(value);
+		else if (!strcmp(argv[i - 1], "-f")) opt.frames = atoi(value);
+		else if (!strcmp(argv[i - 1], "-v")) opt.viewers = atoi(value);
+		else if (!strcmp(argv[i - 1], "-r")) opt.rate = atoi(value);
+		else if (!strcmp(argv[i - 1], "-p")) {
+			if (!chip8PlatformFromName(value, opt.platform))
+				return usage();
+			opt.forcePlatform = true;
+		}
+		else return usage();
+	}
+
+	if (!strcmp(argv[1], "serve"))
+		return opt.rom && opt.ips > 0 ? serve(opt) : usage();
+	if (opt.rom)
+		return usage();
+	if (!strcmp(argv[1], "view"))
+		return view(opt);
+	if (!strcmp(argv[1], "bench"))
+		return opt.frames > 0 && opt.viewers > 0 ? bench(opt) : usage();
+	return usage();
+}